@@ -0,0 +1,343 @@
+// Benchmark runner, built with optimizations by make bench.
+//
+// A benchmark is either a Lisp file defining (bench), bench-iterations
+// and optionally bench-expected, or one of the built in reader and
+// printer throughput tests on a generated file. Every repetition runs in
+// a fresh interpreter: the file is loaded, then (bench) is evaluated
+// bench-iterations times as top level forms, so the collector runs in
+// between like it does for any script. Only the iterations are timed.
+//
+// Results are written as tab separated lines, one per benchmark, and
+// compared against a baseline written the same way.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lisp.h"
+#include "reader.h"
+#include "stats.h"
+#include "extension.h"
+
+#define REPS_MAX 100
+#define RESULTS_MAX 64
+// forms in the file the reader and printer benchmarks work on, and the
+// passes over it they make
+#define GENERATED_FORMS 5000
+#define GENERATED_PASSES 5
+
+typedef struct {
+    // a file or a built in benchmark, and its name in the results
+    char *path;
+    char *name;
+    int iterations;
+    double times[REPS_MAX];
+    double median;
+    double min;
+    unsigned long allocs;
+    unsigned long gcCycles;
+    double gcPauseTotal;
+    double gcPauseMax;
+    bool failed;
+} Result;
+
+typedef struct {
+    unsigned long allocs;
+    unsigned long gcCycles;
+    double gcPauseTotal;
+    double gcPauseMax;
+} Snapshot;
+
+static Snapshot snapshot(VM *vm) {
+    Snapshot snap = {0};
+    const Stats *stats = lisp_stats(vm);
+    if (stats == NULL) return snap;
+    for (int t = 0; t < TypeCount; t++) { snap.allocs += stats->allocs[t]; }
+    snap.gcCycles = stats->gcCycles;
+    snap.gcPauseTotal = stats->gcPauseTotal;
+    snap.gcPauseMax = stats->gcPauseMax;
+    return snap;
+}
+
+static void record(Result *result, Snapshot before, Snapshot after) {
+    result->allocs = after.allocs - before.allocs;
+    result->gcCycles = after.gcCycles - before.gcCycles;
+    result->gcPauseTotal = after.gcPauseTotal - before.gcPauseTotal;
+    result->gcPauseMax = after.gcPauseMax;
+}
+
+static FILE *generated = NULL;
+
+// Nested lists of symbols, numbers and strings, the same on every run.
+// A program has a few hundred distinct symbols, not one per form.
+static FILE *generated_forms(void) {
+    if (generated) {
+        rewind(generated);
+        return generated;
+    }
+    generated = tmpfile();
+    for (int i = 0; i < GENERATED_FORMS; i++) {
+        fprintf(generated,
+                "(define item-%d (quote (node %d \"label-%d\" (leaf a b c)"
+                " (leaf %d %d) (x (y (z %d))))))\n",
+                i % 200, i, i, i % 97, i * 7, i % 13);
+    }
+    rewind(generated);
+    return generated;
+}
+
+// one pass over the generated file
+static bool run_reader(VM *vm) {
+    FILE *input = generated_forms();
+    int forms = 0;
+    while (lisp_read_form(vm, input) != NULL) { forms++; }
+    // nothing read is kept, let the next pass start from an empty heap
+    gc_safepoint(vm);
+    return forms == GENERATED_FORMS;
+}
+
+static bool run_printer(Cell *forms, FILE *out) {
+    dolist_cdr(form, forms) {
+        fprint_expr(out, car(form));
+        fputc('\n', out);
+    }
+    return true;
+}
+
+static Cell *read_all(VM *vm) {
+    Cell *forms = nil();
+    Cell *form;
+    FILE *input = generated_forms();
+    while ((form = lisp_read_form(vm, input)) != NULL) {
+        forms = cons(form, forms);
+    }
+    return forms;
+}
+
+static bool load_file(VM *vm, char *path) {
+    FILE *input = fopen(path, "r");
+    if (input == NULL) {
+        perror(path);
+        return false;
+    }
+    Cell *exp;
+    bool ok = true;
+    while (ok && (exp = lisp_read_form(vm, input)) != NULL) {
+        bool raised = is_error(exp);
+        Cell *result = raised ? exp : lisp_eval(vm, exp, &raised);
+        if (raised) {
+            fprintf(stderr, "%s: ", path);
+            fprint_expr(stderr, result);
+            fprintf(stderr, "\n");
+            ok = false;
+        }
+    }
+    fclose(input);
+    return ok;
+}
+
+// NULL when name is not defined
+static Cell *lookup_global(VM *vm, char *name) {
+    bool raised;
+    Cell *val = lisp_eval_string(vm, name, &raised);
+    return raised ? NULL : val;
+}
+
+// Runs one repetition in a fresh interpreter, returns its time in seconds
+// or a negative number when the benchmark failed.
+static double run_once(char *name, Result *result) {
+    VM *vm = lisp_open();
+    double start, end;
+    bool ok = true;
+    Snapshot before;
+
+    if (string_eq(name, "reader")) {
+        result->iterations = GENERATED_PASSES;
+        before = snapshot(vm);
+        start = stats_now();
+        for (int i = 0; ok && i < result->iterations; i++) {
+            ok = run_reader(vm);
+        }
+        end = stats_now();
+    } else if (string_eq(name, "printer")) {
+        result->iterations = GENERATED_PASSES;
+        // nothing collects between the passes, so the forms stay put
+        Cell *forms = read_all(vm);
+        FILE *out = fopen("/dev/null", "w");
+        before = snapshot(vm);
+        start = stats_now();
+        for (int i = 0; ok && i < result->iterations; i++) {
+            ok = run_printer(forms, out);
+        }
+        end = stats_now();
+        fclose(out);
+    } else {
+        if (!load_file(vm, name)) {
+            lisp_close(vm);
+            return -1;
+        }
+        Cell *iterations = lookup_global(vm, "bench-iterations");
+        result->iterations = iterations && is_integer(iterations)
+            ? int_val(iterations) : 1;
+        Cell *expected = lookup_global(vm, "bench-expected");
+        ext_gc_root(vm, &expected);
+
+        Cell *value = nil();
+        before = snapshot(vm);
+        start = stats_now();
+        for (int i = 0; ok && i < result->iterations; i++) {
+            bool raised;
+            value = lisp_eval_string(vm, "(bench)", &raised);
+            ok = !raised;
+        }
+        end = stats_now();
+        if (!ok || (expected && !equal(value, expected))) {
+            fprintf(stderr, "%s: unexpected result ", name);
+            fprint_expr(stderr, value);
+            fprintf(stderr, "\n");
+            ok = false;
+        }
+        ext_gc_unroot(vm, &expected);
+    }
+
+    record(result, before, snapshot(vm));
+    lisp_close(vm);
+    return ok ? end - start : -1;
+}
+
+static int by_time(const void *x, const void *y) {
+    double a = *(double*)x, b = *(double*)y;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+// the benchmark name without its directory and extension
+static char *short_name(char *path) {
+    char *base = strrchr(path, '/');
+    base = strdup(base ? base + 1 : path);
+    char *ext = strrchr(base, '.');
+    if (ext) *ext = '\0';
+    return base;
+}
+
+static void run_benchmark(char *path, int warmup, int reps, Result *result) {
+    result->path = path;
+    result->name = short_name(path);
+    for (int i = 0; i < warmup; i++) {
+        if (run_once(path, result) < 0) {
+            result->failed = true;
+            return;
+        }
+    }
+    for (int i = 0; i < reps; i++) {
+        result->times[i] = run_once(path, result);
+        if (result->times[i] < 0) {
+            result->failed = true;
+            return;
+        }
+    }
+    qsort(result->times, reps, sizeof(double), by_time);
+    result->min = result->times[0];
+    result->median = result->times[reps / 2];
+}
+
+static bool write_results(char *path, Result *results, int size) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        return false;
+    }
+    fprintf(out, "benchmark\titerations\tmedian_ms\tmin_ms\tallocations"
+            "\tgc_cycles\tgc_pause_total_ms\tgc_pause_max_ms\n");
+    for (int i = 0; i < size; i++) {
+        Result *r = &results[i];
+        if (r->failed) continue;
+        fprintf(out, "%s\t%d\t%.3f\t%.3f\t%lu\t%lu\t%.3f\t%.3f\n",
+                r->name, r->iterations, r->median * 1e3,
+                r->min * 1e3, r->allocs, r->gcCycles, r->gcPauseTotal * 1e3,
+                r->gcPauseMax * 1e3);
+    }
+    return fclose(out) == 0;
+}
+
+// Fastest time in ms of name in a results file, negative when missing.
+// Noise only ever adds time, so the fastest run is what gets compared.
+static double baseline_min(FILE *baseline, char *name) {
+    char line[512], benchmark[128];
+    double min;
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline)) {
+        if (sscanf(line, "%127s %*d %*f %lf", benchmark, &min) == 2
+            && string_eq(benchmark, name))
+            return min;
+    }
+    return -1;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [--reps n] [--warmup n] [--out path] [--baseline path]"
+            " [--threshold percent] benchmark...\n"
+            "  a benchmark is a .lisp file, reader or printer; the exit\n"
+            "  status is 1 when one fails or its fastest run is slower than\n"
+            "  the baseline by more than the threshold (10%% unless given)\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    int reps = 5, warmup = 1;
+    double threshold = 10;
+    char *out = NULL, *baselinePath = NULL;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (string_eq(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (string_eq(argv[i], "--warmup") && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (string_eq(argv[i], "--out") && i + 1 < argc) {
+            out = argv[++i];
+        } else if (string_eq(argv[i], "--baseline") && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (string_eq(argv[i], "--threshold") && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (i == argc || reps < 1 || reps > REPS_MAX
+        || argc - i > RESULTS_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *baseline = NULL;
+    if (baselinePath && (baseline = fopen(baselinePath, "r")) == NULL)
+        perror(baselinePath);
+
+    Result results[RESULTS_MAX] = {0};
+    int size = 0, status = 0;
+    printf("%-16s %10s %10s %12s %6s %10s %10s\n", "benchmark", "median ms",
+           "min ms", "allocations", "gcs", "pause ms", "baseline");
+    for (; i < argc; i++, size++) {
+        Result *r = &results[size];
+        run_benchmark(argv[i], warmup, reps, r);
+        if (r->failed) {
+            printf("%-16s FAILED\n", r->name);
+            status = 1;
+            continue;
+        }
+        printf("%-16s %10.2f %10.2f %12lu %6lu %10.2f", r->name, r->median * 1e3,
+               r->min * 1e3, r->allocs, r->gcCycles, r->gcPauseTotal * 1e3);
+        double base = baseline ? baseline_min(baseline, r->name) : -1;
+        if (base > 0) {
+            double change = (r->min * 1e3 - base) / base * 100;
+            printf(" %+9.1f%%%s", change,
+                   change > threshold ? " REGRESSION" : "");
+            if (change > threshold) status = 1;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (baseline) fclose(baseline);
+    if (out && !write_results(out, results, size)) status = 1;
+    return status;
+}
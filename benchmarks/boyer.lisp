@@ -0,0 +1,126 @@
+; Boyer style term rewriting: lemmas rewrite a propositional term into
+; if-normal form, then a tautology checker walks the result. As in the
+; original, every atom of a lemma is a pattern variable and constants
+; are nullary terms such as (t).
+(define (assq x alist)
+  (if alist
+      (if (eq x (car (car alist))) (car alist) (assq x (cdr alist)))
+      nil))
+
+(define (term-equal a b)
+  (if (atom? a)
+      (eq a b)
+      (if (atom? b)
+          nil
+          (if (term-equal (car a) (car b)) (term-equal (cdr a) (cdr b)) nil))))
+
+(define (member-term x l)
+  (if l (if (term-equal x (car l)) t (member-term x (cdr l))) nil))
+
+(define lemmas
+  (quote ((and ((and p q) (if p (if q (t) (f)) (f))))
+          (or ((or p q) (if p (t) (if q (t) (f)))))
+          (not ((not p) (if p (f) (t))))
+          (implies ((implies p q) (if p (if q (t) (f)) (t))))
+          (iff ((iff p q) (and (implies p q) (implies q p))))
+          (if ((if (if a b c) d e) (if a (if b d e) (if c d e))))
+          (equal ((equal (plus a b) (zero)) (and (zerop a) (zerop b)))
+                 ((equal (difference x y) (zero)) (not (lessp y x)))
+                 ((equal a a) (t)))
+          (plus ((plus (plus x y) z) (plus x (plus y z)))
+                ((plus (zero) x) x))
+          (difference ((difference x x) (zero))
+                      ((difference (plus x y) x) y))
+          (lessp ((lessp (plus x y) (plus x z)) (lessp y z))))))
+
+; substitutions map pattern variables to terms, fail when nothing does
+(define (unify term pat subst)
+  (if (eq subst (quote fail))
+      subst
+      (if (atom? pat)
+          (unify-var term pat subst (assq pat subst))
+          (if (atom? term)
+              (quote fail)
+              (if (eq (car term) (car pat))
+                  (unify-args (cdr term) (cdr pat) subst)
+                  (quote fail))))))
+
+(define (unify-var term pat subst binding)
+  (if binding
+      (if (term-equal term (cdr binding)) subst (quote fail))
+      (cons (cons pat term) subst)))
+
+(define (unify-args terms pats subst)
+  (if terms
+      (if pats
+          (unify-args (cdr terms) (cdr pats) (unify (car terms) (car pats) subst))
+          (quote fail))
+      (if pats (quote fail) subst)))
+
+(define (apply-subst subst term)
+  (if (atom? term)
+      (subst-var (assq term subst) term)
+      (cons (car term) (apply-subst-list subst (cdr term)))))
+
+(define (subst-var binding term) (if binding (cdr binding) term))
+
+(define (apply-subst-list subst terms)
+  (if terms
+      (cons (apply-subst subst (car terms)) (apply-subst-list subst (cdr terms)))
+      nil))
+
+(define (rewrite term)
+  (if (atom? term)
+      term
+      (rewrite-with-lemmas (cons (car term) (rewrite-args (cdr term)))
+                           (cdr (assq (car term) lemmas)))))
+
+(define (rewrite-args terms)
+  (if terms (cons (rewrite (car terms)) (rewrite-args (cdr terms))) nil))
+
+(define (rewrite-with-lemmas term lemmas)
+  (if lemmas
+      (try-lemma term (car lemmas) (cdr lemmas)
+                 (unify term (car (car lemmas)) nil))
+      term))
+
+(define (try-lemma term lemma lemmas subst)
+  (if (eq subst (quote fail))
+      (rewrite-with-lemmas term lemmas)
+      (rewrite (apply-subst subst (car (cdr lemma))))))
+
+(define (truep x true-list)
+  (if (term-equal x (quote (t))) t (member-term x true-list)))
+
+(define (falsep x false-list)
+  (if (term-equal x (quote (f))) t (member-term x false-list)))
+
+(define (tautologyp x true-list false-list)
+  (if (truep x true-list)
+      t
+      (if (falsep x false-list)
+          nil
+          (if (atom? x)
+              nil
+              (if (eq (car x) (quote if))
+                  (tautology-if (car (cdr x)) (car (cdr (cdr x)))
+                                (car (cdr (cdr (cdr x))))
+                                true-list false-list)
+                  nil)))))
+
+(define (tautology-if test then else true-list false-list)
+  (if (truep test true-list)
+      (tautologyp then true-list false-list)
+      (if (falsep test false-list)
+          (tautologyp else true-list false-list)
+          (if (tautologyp then (cons test true-list) false-list)
+              (tautologyp else true-list (cons test false-list))
+              nil))))
+
+(define (tautp x) (tautologyp (rewrite x) nil nil))
+
+(define (bench)
+  (tautp (quote (implies (and (implies (x) (y)) (implies (y) (z)))
+                         (implies (x) (z))))))
+(define bench-iterations 1)
+(define bench-expected t)
@@ -0,0 +1,7 @@
+; non tail recursion as deep as the C stack of an -O0 build allows
+(define (depth n)
+  (if (= n 0) 0 (+ 1 (depth (- n 1)))))
+
+(define (bench) (depth 4000))
+(define bench-iterations 10)
+(define bench-expected 4000)
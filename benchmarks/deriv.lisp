@@ -0,0 +1,38 @@
+; symbolic derivative, from the Gabriel benchmarks, allocation heavy
+(define (map-deriv l)
+  (if l (cons (deriv (car l)) (map-deriv (cdr l))) nil))
+
+(define (map-deriv-quotient l)
+  (if l
+      (cons (list (quote /) (deriv (car l)) (car l))
+            (map-deriv-quotient (cdr l)))
+      nil))
+
+(define (deriv a)
+  (if (atom? a)
+      (if (eq a (quote x)) 1 0)
+      (if (eq (car a) (quote +))
+          (cons (quote +) (map-deriv (cdr a)))
+          (if (eq (car a) (quote -))
+              (cons (quote -) (map-deriv (cdr a)))
+              (if (eq (car a) (quote *))
+                  (list (quote *) a
+                        (cons (quote +) (map-deriv-quotient (cdr a))))
+                  (quote error))))))
+
+(define (run n)
+  (if (= n 0)
+      nil
+      (begin
+        (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))
+        (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))
+        (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))
+        (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))
+        (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))
+        (run (- n 1)))))
+
+(define (bench)
+  (run 100)
+  (car (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))))
+(define bench-iterations 3)
+(define bench-expected (quote +))
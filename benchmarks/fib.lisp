@@ -0,0 +1,9 @@
+; doubly recursive fibonacci, calls and integer arithmetic
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (bench) (fib 18))
+(define bench-iterations 5)
+(define bench-expected 2584)
@@ -0,0 +1,23 @@
+; churns through short lived lists while a long lived one stays around,
+; every iteration is a top level form so the collector gets to run
+(define keep nil)
+
+(define (build n acc)
+  (if (= n 0) acc (build (- n 1) (cons n acc))))
+
+; ten short lived cells per step
+(define (garbage n acc)
+  (if (= n 0) acc (garbage (- n 1) (cons (list n n n n n n n n n) acc))))
+
+(define (count l)
+  (if l (+ 1 (count (cdr l))) 0))
+
+(define (churn n)
+  (if (= n 0) nil (begin (garbage 100 nil) (churn (- n 1)))))
+
+(define (bench)
+  (set! keep (cons (build 1000 nil) keep))
+  (churn 200)
+  (count (car keep)))
+(define bench-iterations 8)
+(define bench-expected 1000)
@@ -0,0 +1,30 @@
+; counts the solutions of the eight queens problem, list heavy
+(define (append x y)
+  (if x (cons (car x) (append (cdr x) y)) y))
+
+(define (iota n)
+  (if (= n 0) nil (cons n (iota (- n 1)))))
+
+; no queen in placed is on a diagonal of row, dist columns away
+(define (ok? row dist placed)
+  (if placed
+      (if (= (car placed) (+ row dist))
+          nil
+          (if (= (car placed) (- row dist))
+              nil
+              (ok? row (+ dist 1) (cdr placed))))
+      t))
+
+(define (try-it x y z)
+  (if x
+      (+ (if (ok? (car x) 1 z)
+             (try-it (append (cdr x) y) nil (cons (car x) z))
+             0)
+         (try-it (cdr x) (cons (car x) y) z))
+      (if y 0 1)))
+
+(define (queens n) (try-it (iota n) nil nil))
+
+(define (bench) (queens 8))
+(define bench-iterations 1)
+(define bench-expected 92)
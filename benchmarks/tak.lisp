@@ -0,0 +1,11 @@
+; Takeuchi, from the Gabriel benchmarks
+(define (tak x y z)
+  (if (< y x)
+      (tak (tak (- x 1) y z)
+           (tak (- y 1) z x)
+           (tak (- z 1) x y))
+      z))
+
+(define (bench) (tak 18 12 6))
+(define bench-iterations 1)
+(define bench-expected 7)
@@ -0,0 +1,105 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "client.h"
+
+LispClient *client_connect(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    LispClient *c = calloc(1, sizeof(LispClient));
+    c->fd = fd;
+    return c;
+}
+
+void client_close(LispClient *c) {
+    close(c->fd);
+    free(c->buf);
+    free(c);
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const unsigned char *p = data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    unsigned char *p = data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int client_send(LispClient *c, const char *src, size_t size) {
+    if (size > FRAME_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    unsigned char header[FRAME_HEADER_SIZE];
+    frame_put_length(header, size);
+    if (write_all(c->fd, header, sizeof(header)) != 0)
+        return -1;
+    return write_all(c->fd, src, size);
+}
+
+int client_receive(LispClient *c, char **text, size_t *size) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (read_all(c->fd, header, sizeof(header)) != 0)
+        return -1;
+    uint32_t n = frame_length(header);
+    if (n < 1 || n > FRAME_MAX) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n + 1 > c->capacity) {
+        c->capacity = n + 1;
+        c->buf = realloc(c->buf, c->capacity);
+    }
+    if (read_all(c->fd, c->buf, n) != 0)
+        return -1;
+    c->buf[n] = '\0';
+    *text = (char *)c->buf + 1;
+    if (size != NULL)
+        *size = n - 1;
+    return c->buf[0];
+}
+
+int client_eval(LispClient *c, const char *src, char **text) {
+    if (client_send(c, src, strlen(src)) != 0)
+        return -1;
+    return client_receive(c, text, NULL);
+}
@@ -0,0 +1,157 @@
+// Load test for the evaluation server, built by make client.
+//
+// Each connection runs on a thread of its own and sends the same request
+// over and over, keeping up to --pipeline of them in flight. The latency
+// of a request is from sending it to receiving its response. Every
+// response has to be FRAME_OK, and the printed value given by --expect
+// when there is one, or FRAME_ERROR with --expect-error.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client.h"
+
+#define CONNECTIONS_MAX 256
+#define PIPELINE_MAX 1024
+
+typedef struct {
+    const char *path;
+    const char *src;
+    const char *expect;
+    bool expectError;
+    long requests;
+    int pipeline;
+    // seconds, one per request
+    double *latencies;
+    long failures;
+} Load;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool expected(Load *load, int status, char *text) {
+    if (load->expectError)
+        return status == FRAME_ERROR;
+    return status == FRAME_OK
+        && (load->expect == NULL || strcmp(text, load->expect) == 0);
+}
+
+static void *run_connection(void *arg) {
+    Load *load = arg;
+    LispClient *c = client_connect(load->path);
+    if (c == NULL) {
+        perror(load->path);
+        load->failures = load->requests;
+        return NULL;
+    }
+    size_t size = strlen(load->src);
+    // send times of the requests in flight, by request number
+    double sent[PIPELINE_MAX];
+    long next = 0;
+    for (long done = 0; done < load->requests; done++) {
+        while (next < load->requests && next - done < load->pipeline) {
+            sent[next % PIPELINE_MAX] = now();
+            if (client_send(c, load->src, size) != 0)
+                goto failed;
+            next++;
+        }
+        char *text;
+        int status = client_receive(c, &text, NULL);
+        if (status < 0)
+            goto failed;
+        load->latencies[done] = now() - sent[done % PIPELINE_MAX];
+        if (!expected(load, status, text)) {
+            if (load->failures++ == 0)
+                fprintf(stderr, "unexpected response, %c %s\n", status, text);
+        }
+    }
+    client_close(c);
+    return NULL;
+
+failed:
+    perror("connection");
+    load->failures = load->requests;
+    client_close(c);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s --socket path [--connections n] [--requests n]"
+            " [--pipeline n] [--expect text | --expect-error] [request]\n"
+            "  each connection sends the request (+ 1 2 unless given)\n"
+            "  --requests times (1000), --pipeline (1) at a time; the exit\n"
+            "  status is 1 when a response is not the one expected\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    Load proto = {.src = "(+ 1 2)", .requests = 1000, .pipeline = 1};
+    int connections = 1;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            proto.path = argv[++i];
+        } else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            proto.requests = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+            proto.pipeline = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc) {
+            proto.expect = argv[++i];
+        } else if (strcmp(argv[i], "--expect-error") == 0) {
+            proto.expectError = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (i < argc)
+        proto.src = argv[i++];
+    if (i < argc || proto.path == NULL || connections < 1
+        || connections > CONNECTIONS_MAX || proto.requests < 1
+        || proto.pipeline < 1 || proto.pipeline > PIPELINE_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long total = proto.requests * connections;
+    double *latencies = calloc(total, sizeof(double));
+    Load loads[CONNECTIONS_MAX];
+    pthread_t threads[CONNECTIONS_MAX];
+    double start = now();
+    for (int j = 0; j < connections; j++) {
+        loads[j] = proto;
+        loads[j].latencies = latencies + j * proto.requests;
+        pthread_create(&threads[j], NULL, run_connection, &loads[j]);
+    }
+    long failures = 0;
+    for (int j = 0; j < connections; j++) {
+        pthread_join(threads[j], NULL);
+        failures += loads[j].failures;
+    }
+    double elapsed = now() - start;
+
+    qsort(latencies, total, sizeof(double), compare_doubles);
+    printf("%ld requests on %d connections in %.3f s, %.0f requests/s\n",
+           total, connections, elapsed, total / elapsed);
+    printf("latency us: p50 %.1f  p99 %.1f  max %.1f\n",
+           latencies[total / 2] * 1e6, latencies[total * 99 / 100] * 1e6,
+           latencies[total - 1] * 1e6);
+    if (failures > 0)
+        printf("%ld failed\n", failures);
+    free(latencies);
+    return failures > 0;
+}
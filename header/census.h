@@ -0,0 +1,55 @@
+
+#ifndef CENSUS_HEADER
+#define CENSUS_HEADER
+
+#include <signal.h>
+#include "data.h"
+
+// Heap census: a linear scan of the heap telling what is live, by type,
+// and which roots retain the most of it. A global binding, a stack slot,
+// the region frames of a thread or a C root retains the cells only it
+// can reach; cells reachable from more than one root are counted as
+// shared. The census marks through the moveTo field without moving
+// anything, so it can run in the middle of an evaluation (cells only held
+// by C locals then show up as dead).
+
+// number of roots reported by retained size
+#define CENSUS_TOP 10
+
+typedef struct {
+    const char *label;
+    size_t cells;
+    size_t bytes;
+} Retained;
+
+typedef struct {
+    size_t heapCells;
+    size_t liveCells;
+    size_t liveBytes;
+    size_t cells[TypeCount];
+    // cells and what they point to outside of the heap
+    size_t bytes[TypeCount];
+    Retained top[CENSUS_TOP];
+    int topSize;
+    Retained shared;
+} Census;
+
+void heap_census(VM *vm, Census *census);
+// a readable report, with the sampled allocation sites of LISP_STATS
+void census_dump(VM *vm, FILE *out);
+// the same as an alist, for (heap-census), totals past INT_MAX read as it
+Cell *census_to_list(VM *vm);
+
+// Dumps a census on stderr when sig arrives. The handler only sets a
+// flag, the report is written at the next census_poll with no futures
+// running. Signals are per process: with several VMs, the one that polls
+// first reports.
+void census_on_signal(int sig);
+extern volatile sig_atomic_t census_requested;
+#define census_poll(vm) ({                                              \
+            if (census_requested && !vm_parallel(vm)) {                 \
+                census_requested = 0;                                   \
+                census_dump(vm, stderr);                                \
+            }})
+
+#endif
@@ -0,0 +1,41 @@
+
+#ifndef CLIENT_HEADER
+#define CLIENT_HEADER
+
+#include <stddef.h>
+#include "frame.h"
+
+// Client of the evaluation server, see server.h. It does not need the
+// interpreter, build/lisp-client.so is built from client/client.c alone.
+//
+//     LispClient *c = client_connect("/tmp/lisp.sock");
+//     char *text;
+//     if (client_eval(c, "(+ 1 2)", &text) == FRAME_OK) puts(text);
+//     client_close(c);
+//
+// Requests may be pipelined by sending several before receiving.
+
+typedef struct {
+    int fd;
+    // the last response, NUL terminated
+    unsigned char *buf;
+    size_t capacity;
+} LispClient;
+
+// NULL with errno set when the server cannot be reached
+LispClient *client_connect(const char *path);
+void client_close(LispClient *c);
+
+// -1 with errno set when the connection fails
+int client_send(LispClient *c, const char *src, size_t size);
+
+// Blocks for the response to the oldest request not received yet. Returns
+// FRAME_OK or FRAME_ERROR with *text (and *size when not NULL) set to the
+// printed result, valid until the next call, or -1 when the connection
+// fails or the response is not a well formed frame.
+int client_receive(LispClient *c, char **text, size_t *size);
+
+// client_send and client_receive for a NUL terminated src
+int client_eval(LispClient *c, const char *src, char **text);
+
+#endif
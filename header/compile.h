@@ -0,0 +1,95 @@
+
+#ifndef COMPILE_HEADER
+#define COMPILE_HEADER
+
+#include "condition.h"
+#include "extension.h"
+#include "lisp.h"
+#include "text.h"
+
+// Ahead of time compiler, (compile-file "x.lisp") or make compile.
+//
+// The global procedures a file defines with (define (name params...) ...)
+// are translated to C against the Cell API, built into a shared object
+// with the C compiler the runtime was built with and loaded as an
+// extension, so that they replace the interpreted ones. The rest of the
+// file is not evaluated, only its define-macro forms are, to expand the
+// bodies. A procedure using lambda, define, quasiquote, catch,
+// unwind-protect or a rest parameter stays interpreted.
+//
+// Calls between procedures of the same file are direct C calls, bound
+// when the file is compiled, and the arithmetic and list primitives are
+// open coded, assuming nothing redefines them. A procedure whose
+// parameters are only used as integers and whose value is an integer
+// gets a second version on unboxed ints, used when it is called with
+// integers. An unboxed int has no cell, so eq compares it to an integer
+// by value: compiled (eq a b) holds for two cells of the same integer,
+// interpreted only when it is from SMALL_INT_MIN to SMALL_INT_MAX.
+//
+// The C file is written next to the shared object, with .c in place of
+// its .so. Loading the same path again in a process keeps the object
+// already loaded.
+
+// its words are split at spaces, it runs without a shell
+#ifndef LISP_CC
+#define LISP_CC "gcc -O2 -shared -fPIC -w"
+#endif
+// where generated code finds the runtime headers
+#ifndef LISP_INCLUDE_DIR
+#define LISP_INCLUDE_DIR "header"
+#endif
+
+// procedures compiled from one file
+#define COMPILE_FUNCTIONS_MAX 256
+
+// Returns the names of the procedures compiled, raises when the file
+// cannot be read, the C compiler fails or the object does not load.
+Cell *compile_file(char *src, char *out);
+
+// What generated code uses besides the Cell API.
+
+static inline int compiled_int(Cell *x) {
+    if (!is_integer(x))
+        raise_error("argument is not of type %d", TypeInt);
+    return int_val(x);
+}
+
+// (car nil) and (cdr nil) are nil
+static inline Cell *compiled_car(Cell *x) {
+    if (null(x)) return nil();
+    ensure(x, TypePair);
+    return car(x);
+}
+
+static inline Cell *compiled_cdr(Cell *x) {
+    if (null(x)) return nil();
+    ensure(x, TypePair);
+    return cdr(x);
+}
+
+// eq where one of x and y was an unboxed int
+static inline bool compiled_eq_int(Cell *x, Cell *y) {
+    return x == y
+        || (is_integer(x) && is_integer(y) && int_val(x) == int_val(y));
+}
+
+// At the entry of every compiled procedure, like apply_procedure: a loop
+// of them is interrupted and collected in the middle as well, see gc_eval.
+#define compiled_poll() ({                                              \
+            VM *vm_ = getVM();                                          \
+            Mutator *m_ = getMutator();                                 \
+            interrupt_poll(vm_, m_);                                    \
+            gc_poll(vm_, m_);                                           \
+        })
+
+static inline Cell *compiled_global(Cell *var) {
+    return env_lookup_var(var, getVM()->globals);
+}
+
+static inline Cell *compiled_float(float f) {
+    float *val = malloc(sizeof(float));
+    *val = f;
+    return make_cell(TypeFloat, val);
+}
+
+#endif
@@ -0,0 +1,48 @@
+
+#ifndef CONDITION_HEADER
+#define CONDITION_HEADER
+
+#include <setjmp.h>
+#include "data.h"
+
+// Conditions are raised with a longjmp to the innermost handler, so that
+// evaluation never has to check what it gets back for errors. A handler
+// keeps the parts of the thread's mutator that only the C frames above it
+// use, and raising to it puts them back: the temporaries on its stack, the
+// region and shadow stacks, and the C roots pointing into the frames
+// unwound. Each thread raises to its own handlers.
+typedef struct Handler {
+    jmp_buf jump;
+    struct Handler *prev;
+    int stackSize;
+    int shadowDepth;
+    Cell *regionNext;
+    // set by the raise, before the jump
+    Cell *volatile condition;
+} Handler;
+
+// 0 once the handler is in place, nonzero when a condition was raised to
+// it, by which time it is gone already:
+//     Handler h;
+//     if (handler_enter(m, &h) == 0) { ...; handler_leave(m, &h); }
+//     else { ... h.condition ... }
+#define handler_enter(m, h) (handler_push(m, h), setjmp((h)->jump))
+#define handler_leave(m, h) ((m)->handler = (h)->prev)
+
+void handler_push(Mutator *m, Handler *h);
+
+// Interrupts stop an evaluation from the outside: the VM's own thread
+// raises an error for the reason the next time it applies a procedure.
+// The interrupt stays set, raising again at every application so that a
+// catch cannot hold on, until whoever set it calls lisp_interrupt(vm, 0).
+// Safe in a signal handler.
+void lisp_interrupt(VM *vm, int reason);
+void lisp_interrupted(VM *vm) __attribute__((noreturn));
+#define interrupt_poll(vm, m) ({                                        \
+            if (__atomic_load_n(&(vm)->interrupt, __ATOMIC_RELAXED)     \
+                && (m) == &(vm)->main)                                  \
+                lisp_interrupted(vm);                                   \
+        })
+Cell *make_error(char *msg);
+
+#endif
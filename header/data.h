@@ -2,24 +2,36 @@
 #ifndef LIST_HEADER
 #define LIST_HEADER
 
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 
+// Compiles tracing in, it is printed (on stderr) only once switched on
+// with (trace t) or --trace.
 #define DEBUG
 
 #ifdef DEBUG
-#define debuglog1(msg) printf("%-15s: " msg, __func__)
-#define debuglog(fmt, ...) printf("%-15s: " fmt, __func__, __VA_ARGS__)
+#define tracing() (getVM()->trace)
+#define debuglog1(msg) ({                                               \
+            if (tracing()) fprintf(stderr, "%-15s: " msg, __func__);    \
+        })
+#define debuglog(fmt, ...) ({                                           \
+            if (tracing())                                              \
+                fprintf(stderr, "%-15s: " fmt, __func__, __VA_ARGS__);  \
+        })
 /* #define debuglogln(msg) printf("%-15s: " msg "\n", __func__) */
 
 #define debugObj(cell, msg) ({                                          \
-            printf("%s = ", #cell);                                     \
-            print_expr(cell);                                           \
-            printf(msg);                                                \
-        })
+            if (tracing()) {                                            \
+                fprintf(stderr, "%s = ", #cell);                        \
+                fprint_expr(stderr, cell);                              \
+                fprintf(stderr, msg);                                   \
+            }})
 #define debuglnObj(cell) debugObj(cell, "\n")
 #else
 #define debuglog1(msg)
@@ -30,7 +42,7 @@
 
 #define ensure(exp, thetype) ({                                         \
             if (exp->type != thetype) {                                 \
-                return_error("%s is not of type %d", #exp, thetype);    \
+                raise_error("%s is not of type %d", #exp, thetype);     \
             }})
     
 typedef enum {
@@ -46,58 +58,345 @@ typedef enum {
     TypePair,
     TypePrim,
     TypeError, // 9
-    TypeProcedure
+    TypeProcedure,
+    TypeFuture,
+    TypeBuilder,
+    TypePromise,
+    TypePort,
+    // number of types, keep it last
+    TypeCount
 } LispType;
 
 
 typedef struct cell_t {
     LispType type;
+    // CELL_* bits, in what would otherwise be padding
+    unsigned int flags;
     void *moveTo;
     void *val;
     struct cell_t *next;
 } Cell;
 
 
-// prim uses next field to store name 
-#define prim_name(x) ((char*)x->next)
+// prim uses val field to point at its (static) definition
+#define prim_def(x)  ((const PrimDef*)(x)->val)
+#define prim_name(x) (prim_def(x)->name)
+
+// procedure uses val for (name param . body) and next for its env, so
+// that the whole closure lives in the heap and is traced by the GC. The
+// name is the symbol it was defined as, nil for a lambda.
+#define proc_name(x)  car((Cell*)car(x))
+#define proc_param(x) cadr((Cell*)car(x))
+#define proc_body(x)  cddr((Cell*)car(x))
+#define proc_env(x)   cdr(x)
+
+// A procedure whose body neither closes over nor defines into its env:
+// its frames cannot outlive a call, so they go on the region stack. The
+// envs of its calls are flagged as well, see env_extend_region.
+#define CELL_LOCAL_FRAME 1
+// A global binding some call site cache holds the value of: changing it
+// has to invalidate the caches.
+#define CELL_CACHED_BINDING 2
+// A procedure defined with define-macro, applied to the forms of a call
+// rather than their values.
+#define CELL_MACRO 4
+// The body of a procedure whose macro calls have been expanded.
+#define CELL_EXPANDED 8
+// The body of a procedure the optimizer has been over, see optimize.h.
+#define CELL_OPTIMIZED 16
+
+// Symbols naming special forms have the form in their flags, set when
+// they are interned, so eval tells forms apart without comparing names.
+typedef enum {
+    FormNone,
+    FormQuote,
+    FormIf,
+    FormAssignment,
+    FormDefine,
+    FormDefineMacro,
+    FormLambda,
+    FormSequence,
+    FormQuasiquote,
+    FormUnquote,
+    FormUnquoteSplicing,
+    FormInlined,
+    FormCatch,
+    FormUnwindProtect,
+    FormFuture,
+    FormDelay,
+    FormConsStream,
+    FormStreamFold,
+    // number of forms, keep it last
+    FormCount
+} SpecialForm;
+
+#define symbol_form(x) (is_symbol(x) ? (SpecialForm)(x)->flags : FormNone)
+
+// A future keeps its state in flags and (procedure . args) in val until
+// it is done, then its value, or the condition it raised. See pool.h.
+#define FUTURE_PENDING 0
+#define FUTURE_RUNNING 1
+#define FUTURE_DONE    2
+#define FUTURE_RAISED  3
+
+// A promise keeps (procedure . args) in next until it is forced, then its
+// value in val. See stream.h.
+#define PROMISE_DELAYED 0
+#define PROMISE_STORING 1
+#define PROMISE_DONE    2
+
+// cells whose val and next fields are pointers to other cells
+#define has_refs(x)  (is_pair(x) || is_procedure(x) || is_future(x) \
+                      || is_promise(x))
+
+// Primitives get their evaluated arguments in an array, the evaluator
+// checks the count against the arity declared in their PrimDef first.
+typedef Cell *(*PrimLispFn)(int argc, Cell **argv);
+
+// maxArgs for primitives taking any number of arguments
+#define ARGS_MANY -1
 
 typedef struct {
-    Cell *param;
-    Cell *body;
-    Cell *env;
-} Procedure;
+    char *name;
+    PrimLispFn fn;
+    int minArgs;
+    int maxArgs;
+} PrimDef;
 
 // GC code from https://github.com/munificent/lisp2-gc
 
 #define STACK_MAX 256
+#define ROOTS_MAX 64
+#define EXTENSIONS_MAX 16
+#define EXT_PRIMS_MAX 256
+#define SHADOW_STACK_MAX 1024
+// entries of the call site cache, a power of two
+#define CALL_CACHE_SIZE 4096
+// number of cells allocated before a collection is due
 #define HEAP_SIZE (1024 * 1024)
+// number of cells reserved for the heap, it never moves once mapped
+#define HEAP_MAX (64 * HEAP_SIZE)
+// cells in use past which evaluation raises, what is allocated until it
+// does goes in the rest of the reservation
+#define HEAP_LIMIT (HEAP_MAX - HEAP_SIZE)
+// cells a thread takes from the heap at a time to allocate from
+#define TLAB_SIZE 1024
+// number of cells reserved for the frames of CELL_LOCAL_FRAME procedures,
+// calls past it get heap frames
+#define REGION_SIZE (64 * 1024)
+// integers in this range are preallocated and never take a heap cell
+#define SMALL_INT_MIN -128
+#define SMALL_INT_MAX 1023
+
+// What the operator of a call site resolved to the last time, when it
+// was a global binding.
+typedef struct {
+    Cell *site;
+    Cell *callee;
+    LispType kind;
+    unsigned long version;
+} CallCache;
 
+// Free cells between the ones a collection kept in place, see gc_eval.
 typedef struct {
+    Cell *start;
+    Cell *end;
+} Hole;
+
+// What a thread evaluating in a VM keeps to itself. The thread running
+// the VM uses vm->main, the workers running futures have their own.
+typedef struct Mutator {
+    // temporaries the collector updates, see vm_push
     Cell *stack[STACK_MAX];
-
     int stackSize;
+
+    // The part of the heap the thread allocates from without taking it
+    // from the others. Cells past tlab are not initialized, heap_seal
+    // makes them empty before anything walks the heap.
+    Cell *tlab;
+    Cell *tlabEnd;
+    // how many it took, see stack_clear
+    unsigned long refills;
+
+    // Frames that cannot escape their call are bump allocated here and
+    // released when it returns. Nothing in the heap points into it, the
+    // collector takes the frames of vm->main for roots.
+    Cell *region;
+    Cell *regionNext;
+
+    // Call sites hash into the cache by address. An entry is only valid
+    // while its version is vm->bindingsVersion.
+    CallCache callCache[CALL_CACHE_SIZE];
+
+    // runtime statistics, only kept for vm->main
+    struct Stats *stats;
+
+    // Names of the procedures and primitives being applied, innermost
+    // last. Frames past SHADOW_STACK_MAX are counted but not recorded.
+    const char *shadowStack[SHADOW_STACK_MAX];
+    volatile int shadowDepth;
+
+    // innermost handler conditions are raised to, NULL outside lisp_eval
+    struct Handler *handler;
+
+    // While a worker is parked, the part of its C stack in use, see
+    // mutator_park.
+    void **parkedAt;
+    void **stackBase;
+} Mutator;
+
+typedef struct VM {
+    Mutator main;
     unsigned int numObjs;
 
     // The beginning of the contiguous heap of memory that objects are allocated
     // from.
     Cell* heap;
 
-    // The beginning of the next chunk of memory to be allocated from the heap.
+    // The beginning of the next chunk of memory to be allocated from the
+    // heap, threads take TLAB_SIZE cells at a time.
     Cell* next;
+
+    // Heap usage at which the next safepoint collects.
+    Cell* gcThreshold;
+    // Below next, what the last collection left free around the cells it
+    // kept in place, in address order. holesNext is the first one not
+    // used up yet, holeCells the number of cells in all of them.
+    Hole *holes;
+    int holesSize;
+    int holesNext;
+    long holeCells;
+    // How many times gc_eval collected, the cells a fold took for young
+    // may have moved since, see stream_fold.
+    unsigned long evalCollections;
+
+    // The version call cache entries are valid for, which any define, a
+    // set! of a cached binding and a collection (cells move) increment.
+    unsigned long bindingsVersion;
+
+    // Roots besides the stack: the interned symbols and the global env.
+    Cell* symbols;
+    Cell* globals;
+    // Serializes interning, definitions and changes to the roots between
+    // threads. Nothing allocates while holding it, see pool_park.
+    pthread_mutex_t lock;
+
+    // the workers futures run on, NULL until the first one is made
+    struct Pool *pool;
+    // futures not done yet, code is shared with the workers while there
+    // are any, see vm_parallel
+    int tasks;
+    // the workers are to park, see pool_stop
+    bool stopping;
+
+    // Nonzero when evaluation on the VM's own thread is to stop, the
+    // reason why, see lisp_interrupt. Set from signal handlers and other
+    // threads.
+    int interrupt;
+    // TLABs taken from the heap so far, taking the one at tlabLimit (when
+    // nonzero) interrupts with INTERRUPT_MEMORY
+    unsigned long tlabs;
+    unsigned long tlabLimit;
+
+    // Cells held by C code (extensions), updated when the collector moves
+    // them: roots[i] points at rootCounts[i] variables in a row.
+    Cell **roots[ROOTS_MAX];
+    int rootCounts[ROOTS_MAX];
+    int rootsSize;
+
+    // Native extensions and the primitives they registered.
+    char *extensions[EXTENSIONS_MAX];
+    void *extensionHandles[EXTENSIONS_MAX];
+    int extensionsSize;
+    const PrimDef *extPrims[EXT_PRIMS_MAX];
+    int extPrimsSize;
+    // whether extension primitives get bound in the global env
+    bool bindExtPrims;
+
+    // runtime statistics, NULL unless built with LISP_STATS
+    struct Stats *stats;
+    bool trace;
+    // whether procedures get optimized when they are made
+    bool optimize;
 } VM;
 
+#define vm_push(m, x) ((m)->stack[(m)->stackSize++] = (x))
+#define vm_pop(m)     ((m)->stack[--(m)->stackSize])
+
+#define in_heap(vm, x) ((Cell*)(x) >= (vm)->heap && (Cell*)(x) < (vm)->next)
+#define in_region(m, x) \
+    ((Cell*)(x) >= (m)->region && (Cell*)(x) < (m)->regionNext)
+
+#define INTERRUPT_TIMEOUT 1
+#define INTERRUPT_MEMORY  2
+
+// whether futures are running or waiting to, code must not be rewritten
+// in place then
+#define vm_parallel(vm) (__atomic_load_n(&(vm)->tasks, __ATOMIC_ACQUIRE) > 0)
+
 
 #define string_eq(x, y) (strcmp((char *)x, (char *)y) == 0)
 #define cell_type(x) ((x)->type)
+// integers are stored in the val field itself
+#define int_val(x) ((int)(intptr_t)(x)->val)
 
 Cell *nil(void);
+VM *vm_new(void);
+void vm_free(VM *vm);
+VM *vm_switch(VM *vm);
 VM *getVM(void);
+// the state of the calling thread in the VM it runs
+Mutator *getMutator(void);
+void mutator_init(Mutator *m);
+void mutator_free(Mutator *m);
+// makes this thread run vm as a worker with its own m
+void mutator_switch(VM *vm, Mutator *m);
+// makes the cells of a thread's allocation buffer that are not in use
+// empty, heap_seal those of every thread, for walking the heap
+void mutator_seal(Mutator *m);
+void heap_seal(VM *vm);
+void mark(VM* vm, Cell* cell);
 void gc(VM* vm);
+void gc_safepoint(VM* vm);
+// A collection in the middle of an evaluation, at the entry of a
+// procedure. It raises when the cells in use do not fit in HEAP_LIMIT.
+void gc_eval(VM *vm);
+#define gc_due(vm) \
+    (__atomic_load_n(&(vm)->next, __ATOMIC_RELAXED) >= (vm)->gcThreshold)
+// Where a thread may be stopped for a collection: the VM's own thread
+// collects there once it is due, workers park while it runs, see
+// pool_park.
+#define gc_poll(vm, m) ({                                               \
+            if ((m) == &(vm)->main) {                                   \
+                if (gc_due(vm))                                         \
+                    gc_eval(vm);                                        \
+            } else if (__atomic_load_n(&(vm)->stopping, __ATOMIC_ACQUIRE)) \
+                pool_park(vm);                                          \
+        })
+void pool_park(VM *vm);
+// records the C stack of the calling thread from the caller's frame up,
+// which has spilled the registers, for the collector to scan
+void mutator_park(Mutator *m);
+// the VM's own thread's mutator for 0, then the workers', NULL past the
+// last
+Mutator *mutator_at(VM *vm, int i);
+// Clears the stack below the caller, where the frames of the calls that
+// returned were. The frames made there next leave some of their words as
+// they are, gc_eval would take the cells those pointed to for in use.
+void stack_clear(void);
+// where the cells made from now on by the VM's own thread begin, and the
+// collection of those of them not in use, see gc_young. young counts the
+// cells before, a pointer to it on the stack would be taken for one in
+// use by gc_eval.
+long gc_young_start(VM *vm);
+void gc_young(VM *vm, long young);
 
 Cell *make_cell(LispType type, void *data);
+Cell *make_int(int n);
+// integers are ints, a larger count reads as INT_MAX rather than wrapping
+#define make_total(n) make_int((n) > INT_MAX ? INT_MAX : (int)(n))
 Cell *cons(Cell *x, Cell *y);
-int count_obj(Cell *x);
-int count_freeable_obj(Cell *x);
+Cell *region_cons(Mutator *m, Cell *x, Cell *y);
 
 #define car(x)       ((x)->val)
 #define cdr(x)       ((x)->next)
@@ -107,13 +406,16 @@ int count_freeable_obj(Cell *x);
 
 
 
-#define return_error(msg, ...) ({                                       \
+// does not return, the error cell is only made once it is raised
+#define raise_error(msg, ...) ({                                        \
             char str[128];                                              \
-            sprintf(str, "ERROR: %s, " msg,                             \
+            snprintf(str, sizeof(str), "ERROR: %s, " msg,               \
                     __func__, __VA_ARGS__);                             \
-            return make_cell(TypeError, strdup(str));                   \
+            lisp_raise(make_cell(TypeError, strdup(str)));              \
         })
-/* #define make_error(msg) make_cell(TypeError, (void*)msg) */
+
+// unwinds to the innermost handler, see condition.h
+void lisp_raise(Cell *condition) __attribute__((noreturn));
 
 #define is_atom(x)   ((x)->next == NULL)
 
@@ -123,12 +425,16 @@ int count_freeable_obj(Cell *x);
 
 #define is_string(x) (cell_type(x) == TypeString)
 #define is_symbol(x) (cell_type(x) == TypeSymbol)
+#define is_symbol_named(x, name) (is_symbol(x) && string_eq((x)->val, name))
 #define is_pair(x)   (cell_type(x) == TypePair)
 #define is_primitive(x) (cell_type(x) == TypePrim)
 #define is_error(x)  (cell_type(x) == TypeError)
 #define is_procedure(x) (cell_type(x) == TypeProcedure)
-
-typedef Cell *(*PrimLispFn)(Cell*);
+#define is_macro(x)  (is_procedure(x) && ((x)->flags & CELL_MACRO))
+#define is_future(x) (cell_type(x) == TypeFuture)
+#define is_builder(x) (cell_type(x) == TypeBuilder)
+#define is_promise(x) (cell_type(x) == TypePromise)
+#define is_port(x)   (cell_type(x) == TypePort)
 
 // this is more like doRestOfList
 #define dolist_cdr(var, list) for (Cell *var = list; !null(var); var = cdr(var))
@@ -148,6 +454,7 @@ bool null(Cell *x);
 bool is_number(Cell *x);
 
 bool equal(Cell *x, Cell *y);
+char *type_name(LispType type);
 
 Cell *make_cCell(int num, ...);
 
@@ -11,10 +11,16 @@ typedef Cell Environment;
 /* } Environment; */
 
 Environment *init_environment();
+const PrimDef *lookup_prim(char *name);
 Cell *env_add_var_def(Cell *var, Cell *val, Environment *env);
 Cell *env_lookup_var(Cell *var, Environment *env);
+Cell *env_lookup_binding(Cell *var, Environment *env, Environment **scope);
 Cell *env_set_variable_value(Cell *var, Cell *val, Environment *env);
-Environment *env_extend_stack(Cell *arg_syms, Cell *args, Environment *env);
+Environment *env_extend_stack(Cell *arg_syms, int argc, Cell **argv,
+                              Environment *env);
+Environment *env_extend_region(Mutator *m, Cell *arg_syms, int argc,
+                               Cell **argv, Environment *env);
+Environment *env_to_heap(Environment *env);
 
 #endif
 
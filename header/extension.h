@@ -0,0 +1,46 @@
+
+#ifndef EXTENSION_HEADER
+#define EXTENSION_HEADER
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "data.h"
+
+// Native extensions, loaded with (load-extension "path.so").
+//
+// An extension is a shared object exporting
+//
+//     int lisp_extension_init(VM *vm, int apiVersion);
+//
+// which registers its primitives with ext_define_prim and returns 0, or
+// anything else to refuse being loaded. A PrimDef has to outlive the
+// extension (make it static): prim cells point at it, and images rebind
+// it by name after loading the extension again.
+
+#define EXTENSION_API_VERSION 1
+#define EXTENSION_INIT "lisp_extension_init"
+
+typedef int (*ExtensionInitFn)(VM *vm, int apiVersion);
+
+void ext_define_prim(VM *vm, const PrimDef *def);
+
+// Cells kept by C code outside of a primitive call, in a static or across
+// lisp_eval, have to be registered: the collector keeps them alive and
+// updates the variable when it moves them.
+void ext_gc_root(VM *vm, Cell **ref);
+// count variables from refs on, unrooted by refs
+void ext_gc_root_array(VM *vm, Cell **refs, int count);
+void ext_gc_unroot(VM *vm, Cell **ref);
+
+// Returns NULL when path is loaded into the current VM, or why it is not.
+char *load_extension(char *path);
+const PrimDef *lookup_extension_prim(VM *vm, char *name);
+void unload_extensions(VM *vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+
+#ifndef FRAME_HEADER
+#define FRAME_HEADER
+
+#include <stdint.h>
+
+// Frames of the evaluation server protocol, shared by the server and the
+// client library. A frame is a 4 byte big endian length and that many
+// bytes.
+//
+// A request is the source of one or more forms. They are evaluated in
+// order, stopping at the first error, and answered with one response:
+// FRAME_OK and the printed value of the last form, or FRAME_ERROR and the
+// printed error. A client may send requests without waiting for the
+// responses, they come back in the order the requests were sent.
+
+#define FRAME_HEADER_SIZE 4
+// larger frames are a protocol error, the connection is closed
+#define FRAME_MAX (16 * 1024 * 1024)
+
+#define FRAME_OK    'v'
+#define FRAME_ERROR 'e'
+
+static inline void frame_put_length(unsigned char *p, uint32_t n) {
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+static inline uint32_t frame_length(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | p[3];
+}
+
+#endif
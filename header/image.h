@@ -0,0 +1,13 @@
+
+#ifndef IMAGE_HEADER
+#define IMAGE_HEADER
+
+#include "env.h"
+
+// Heap images: the live heap, the symbol table and the global env dumped
+// to a file that can be mapped back in place of init_environment().
+
+bool save_image(char *path);
+Environment *load_image(char *path);
+
+#endif
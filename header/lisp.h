@@ -7,6 +7,25 @@
 
 Cell *eval(Cell *x, Environment *env);
 Cell *apply(Cell *func, Cell *args);
+Cell *apply_argv(Cell *func, int argc, Cell **argv);
+// expands the calls of macros defined in env in the code x, in place
+void expand_macros(Cell *x, Environment *env);
+Cell *load(FILE *input, Environment *env);
+
+// Embedding API. Each interpreter owns all of its state, so independent
+// interpreters can run on different threads at the same time, see
+// tests/vms.c. The profiler, the census signal and the server are per
+// process, see their headers. A call makes its interpreter the current
+// one for the calling thread. Cells returned by an interpreter stay valid
+// until its next lisp_eval. The evaluations set *raised when they return
+// a condition nothing caught.
+VM *lisp_open(void);
+VM *lisp_open_image(char *path);
+void lisp_close(VM *vm);
+void lisp_define(VM *vm, char *name, Cell *val);
+Cell *lisp_read_form(VM *vm, FILE *input);
+Cell *lisp_eval(VM *vm, Cell *exp, bool *raised);
+Cell *lisp_eval_string(VM *vm, char *src, bool *raised);
 
 #endif
 
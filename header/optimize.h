@@ -0,0 +1,27 @@
+
+#ifndef OPTIMIZE_HEADER
+#define OPTIMIZE_HEADER
+
+#include "env.h"
+
+// Source to source pass over the body of a procedure when it is made,
+// while vm->optimize is on (--optimize, or (optimize t) in a file). It
+// folds pure primitive calls on constants and ifs on a constant test,
+// substitutes the arguments of immediately applied lambdas and of calls to
+// small global procedures into their bodies, and drops begin subforms
+// that have no effect.
+//
+// Only constants and local variables nothing assigns are substituted, so
+// no evaluation moves or goes missing. A folded or inlined call becomes
+//     (%inlined binding callee expansion call)
+// which evaluates expansion while the global binding still holds callee,
+// and the original call once it has been redefined.
+
+// nodes in the body of a procedure that gets inlined
+#define INLINE_SIZE_MAX 24
+// inlined bodies inside an inlined body
+#define INLINE_DEPTH_MAX 4
+
+Cell *optimize_body(Cell *body, Cell *params, Environment *env);
+
+#endif
@@ -0,0 +1,54 @@
+
+#ifndef POOL_HEADER
+#define POOL_HEADER
+
+#include "data.h"
+
+// Futures, run by a pool of worker threads sharing the heap and the global
+// env of their VM.
+//
+//     (future exp...)  evaluates the body on a worker
+//     (touch f)        its value once it is done, raising what it raised;
+//                      anything else touches to itself
+//     (pmap f list)    the list of (f x) for each x, each a future
+//
+// Each worker has a deque of futures: it takes the newest of its own and,
+// out of work, steals the oldest from the others. Futures made on the VM's
+// own thread are dealt out to the workers in turn. Touching a future no
+// one has started runs it on the spot, and a thread waiting for one runs
+// others in the meantime.
+//
+// Each thread allocates from its own TLAB_SIZE part of the heap. Only the
+// VM's own thread collects: the workers running a future stop where they
+// take a TLAB, enter a procedure or wait in touch until it is done, see
+// pool_park, and the futures waiting in the deques are roots. Runtime
+// statistics and the profiler only see the VM's own thread.
+//
+// The pool starts with the first future, with a worker per processor
+// besides the VM's thread, or LISP_WORKERS of them.
+
+#define POOL_WORKERS_MAX 64
+// futures waiting for a worker, past it they are run when they are made
+#define POOL_DEQUE_SIZE 4096
+#define POOL_STACK_SIZE (8 * 1024 * 1024)
+
+// a future applying fn to the list args
+Cell *make_future(Cell *fn, Cell *args);
+Cell *touch(Cell *x);
+Cell *pmap(Cell *fn, Cell *list);
+
+// gc_safepoint and gc_eval stop the workers around a collection
+void pool_stop(VM *vm);
+void pool_resume(VM *vm);
+// Stops the calling worker while a collection runs, from gc_poll. The
+// collector scans its C stack for the cells it uses, see gc_eval.
+void pool_park(VM *vm);
+// wakes up the VM's thread waiting in touch, a collection is due
+void pool_wake(VM *vm);
+// the mutator of worker i, NULL past the last one
+Mutator *pool_mutator(VM *vm, int i);
+// mutator_seal for every worker, they are stopped
+void pool_seal(VM *vm);
+void pool_free(VM *vm);
+
+#endif
@@ -0,0 +1,34 @@
+
+#ifndef PROFILE_HEADER
+#define PROFILE_HEADER
+
+#include "data.h"
+
+// Sampling profiler. apply keeps a shadow stack of the Lisp procedures and
+// primitives being applied; while profiling, a SIGPROF timer copies it
+// into a sample buffer, and stopping writes the samples as folded stacks
+// ("outer;inner;leaf count" lines) for flamegraph tools. The timer is per
+// process, so one VM at a time can be profiled, and only the stack of
+// vm->main is sampled.
+
+#define PROFILE_HZ 1000
+// recorded frames per sample, the outermost ones are dropped
+#define PROFILE_DEPTH_MAX 128
+// room for this many frames in total across samples
+#define PROFILE_BUFFER_FRAMES (4 * 1024 * 1024)
+
+// the signal handler may read the stack at any point, so the entry has to
+// be in place before the depth covers it
+#define shadow_push(m, name) ({                                         \
+            if ((m)->shadowDepth < SHADOW_STACK_MAX)                    \
+                (m)->shadowStack[(m)->shadowDepth] = (name);            \
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);                    \
+            (m)->shadowDepth++;                                         \
+        })
+#define shadow_pop(m) ((m)->shadowDepth--)
+
+bool profile_start(VM *vm);
+// returns false when not profiling or path cannot be written
+bool profile_stop(VM *vm, char *path);
+
+#endif
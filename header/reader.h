@@ -6,6 +6,7 @@
 
 Cell *lisp_read(FILE *input);
 void print_expr(Cell *exp);
+void fprint_expr(FILE *out, Cell *exp);
 
 #endif
 
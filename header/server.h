@@ -0,0 +1,39 @@
+
+#ifndef SERVER_HEADER
+#define SERVER_HEADER
+
+#include "data.h"
+#include "frame.h"
+
+// Evaluation server, lisp.out --serve path. One interpreter, kept warm
+// between requests, answers the connections to a Unix domain socket from
+// an epoll loop on the VM's thread. Requests of a connection are
+// evaluated back to back as their frames come in, see frame.h, in the
+// global env they all share. The timer and the signals stopping it are
+// per process, so one VM per process serves.
+//
+// A request running out of time or allocating too much is interrupted,
+// see lisp_interrupt, and answered with the error. Futures do not poll
+// for interrupts, and what the futures of a request allocate counts
+// towards it.
+
+typedef struct {
+    // milliseconds a request may run for, 0 for no limit
+    long timeout;
+    // cells a request may allocate, 0 for no limit
+    unsigned long allocMax;
+} ServerLimits;
+
+#define SERVER_TIMEOUT 10000
+#define SERVER_ALLOC_MAX (16 * HEAP_SIZE)
+// epoll events handled per wakeup
+#define SERVER_EVENTS_MAX 64
+// bytes of responses a connection has not read, past it the server stops
+// evaluating its requests until it does
+#define SERVER_BACKLOG_MAX (1024 * 1024)
+
+// Serves until SIGINT or SIGTERM, replacing what is at path. Returns
+// nonzero, after reporting why on stderr, when the socket cannot be set up.
+int lisp_serve(VM *vm, char *path, ServerLimits limits);
+
+#endif
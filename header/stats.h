@@ -0,0 +1,98 @@
+
+#ifndef STATS_HEADER
+#define STATS_HEADER
+
+#include "data.h"
+
+// Runtime statistics: allocations by type, collections and their pauses,
+// calls per primitive and procedure, and the heap high-water mark. Build
+// with LISP_STATS (make STATS=1, the default) to collect them; without it
+// the hooks below compile to nothing. What the workers running futures do
+// is not counted, the hooks take the mutator and only vm->main has stats.
+
+// pause histogram, bucket i counts pauses under 2^i microseconds and the
+// last one everything longer
+#define GC_PAUSE_BUCKETS 20
+
+typedef struct {
+    // a primitive or symbol name, counted by identity
+    char *name;
+    unsigned long count;
+} CallCount;
+
+// Every ALLOC_SAMPLE_PERIOD-th allocation is attributed to the innermost
+// procedure or primitive being applied, or to the C function allocating
+// when there is none.
+#define ALLOC_SAMPLE_PERIOD 64
+
+typedef struct {
+    // a procedure or primitive name, NULL for a C caller
+    const char *name;
+    void *caller;
+    unsigned long count;
+} AllocSite;
+
+typedef struct Stats {
+    unsigned long allocs[TypeCount];
+    unsigned long gcCycles;
+    unsigned long gcPauses[GC_PAUSE_BUCKETS];
+    double gcPauseTotal;
+    double gcPauseMax;
+    // in cells
+    size_t peakHeap;
+    // open addressing on the name pointer
+    CallCount *calls;
+    size_t callsSize;
+    size_t callsCapacity;
+    // sampled allocation sites, open addressing on (name, caller)
+    AllocSite *sites;
+    size_t sitesSize;
+    size_t sitesCapacity;
+    int sampleCountdown;
+    unsigned long callCacheHits;
+    unsigned long callCacheMisses;
+} Stats;
+
+#ifdef LISP_STATS
+#define stats_alloc(m, type, caller) ({                                 \
+            Stats *_stats = (m)->stats;                                 \
+            if (_stats) {                                               \
+                _stats->allocs[type]++;                                 \
+                if (--_stats->sampleCountdown <= 0)                     \
+                    stats_sample_alloc(m, caller);                      \
+            }})
+#define stats_call(m, name) ({                                          \
+            if ((m)->stats) stats_count_call((m)->stats, name);         \
+        })
+#define stats_call_cache(m, hit) ({                                     \
+            Stats *_stats = (m)->stats;                                 \
+            if (_stats)                                                 \
+                (hit) ? _stats->callCacheHits++ : _stats->callCacheMisses++; \
+        })
+// the heap only shrinks in a collection, so that is where the peak is
+#define stats_gc_begin(vm)    double _gc_start = (lisp_stats(vm), stats_now())
+#define stats_gc_end(vm)      stats_record_gc(vm, _gc_start)
+#else
+#define stats_alloc(m, type, caller)
+#define stats_call(m, name)
+#define stats_call_cache(m, hit)
+#define stats_gc_begin(vm)
+#define stats_gc_end(vm)
+#endif
+
+Stats *stats_new(void);
+void stats_free(Stats *stats);
+double stats_now(void);
+void stats_record_gc(VM *vm, double start);
+void stats_count_call(Stats *stats, char *name);
+void stats_sample_alloc(Mutator *m, void *caller);
+// a printable name for a sampled site
+const char *stats_site_name(const AllocSite *site);
+
+// C API: NULL unless built with LISP_STATS
+const Stats *lisp_stats(VM *vm);
+void stats_dump_json(VM *vm, FILE *out);
+// the same as an alist, for (runtime-stats), counts past INT_MAX read as it
+Cell *stats_to_list(VM *vm);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef STREAM_HEADER
+#define STREAM_HEADER
+
+#include "data.h"
+
+// Promises and the lazy streams made of them.
+//
+//     (delay exp...)          a promise of the value of the body
+//     (force p)               that value, evaluated the first time and kept
+//                             for the next; anything else forces to itself
+//     (cons-stream a exp...)  (cons a (delay exp...))
+//     (stream-car s)          the first element of s
+//     (stream-cdr s)          the rest of s, forced
+//     (stream-map f s)        the stream of (f x) for each x of s
+//     (stream-filter pred s)  the stream of the x of s with (pred x)
+//     (stream-take n s)       the stream of the first n of s
+//     (stream-fold f init s)  (f ... (f (f init x0) x1) ... xn)
+//     (open-input-file path)  a port to read path
+//     (port-stream port ['lines])
+//                             the stream of the forms read from port, or of
+//                             its lines
+//     (close-port port)
+//
+// A stream is nil or a pair of its first element and a promise of the
+// rest, a list is a stream as well. The stream functions force what they
+// are given, and only as much of it as they need. Ports are closed at the
+// end of their stream, or by the collector when nothing refers to them.
+//
+// stream-fold is a special form that runs in constant memory however long
+// the stream: the cells made since it started that are no longer in use,
+// forced promises and their values included, are collected as it goes,
+// see gc_young. Its stream is made in there as well, so that nothing from
+// before holds on to the beginning of it.
+
+// the VM collects the cells a fold made after this many more
+#define STREAM_GC_CELLS HEAP_SIZE
+
+// a promise of applying fn to the list args
+Cell *make_promise(Cell *fn, Cell *args);
+Cell *force(Cell *x);
+
+Cell *stream_map(Cell *fn, Cell *s);
+Cell *stream_filter(Cell *pred, Cell *s);
+Cell *stream_take(long n, Cell *s);
+// state is the function, the initial value and the stream, the top three
+// of the thread's stack, popped on return. young is where the cells made
+// by the fold begin, from gc_young_start before they were evaluated.
+Cell *stream_fold(Cell **state, long young);
+
+Cell *open_port(char *path);
+Cell *port_stream(Cell *port, bool lines);
+void close_port(Cell *port);
+
+#endif
@@ -0,0 +1,78 @@
+
+#ifndef TEXT_HEADER
+#define TEXT_HEADER
+
+#include "data.h"
+
+// Strings are immutable UTF-8 bytes. A string cell points at a String, a
+// slice of a StrBuf: a length prefixed, reference counted buffer outside
+// of the heap, which substring and string-split share instead of copying.
+// The collector frees the slice of a string cell it finds dead, and the
+// buffer with its last slice.
+//
+// Lengths and indexes at the Lisp level count characters. A string that
+// is all ASCII indexes its bytes directly, the others are scanned.
+//
+// Comparing, searching, splitting and counting characters run on AVX2 or
+// SSE2 kernels when the CPU has them, LISP_TEXT_KERNELS=scalar, sse2 or
+// avx2 picks one.
+//
+// A string builder appends strings, and other values printed, to a buffer
+// of its own that grows by doubling. The strings it makes share it. It is
+// not to be added to from several futures at a time.
+
+typedef struct StrBuf {
+    int refs;
+    // bytes in use, by the builder writing into it
+    size_t size;
+    size_t capacity;
+    char bytes[];
+} StrBuf;
+
+typedef struct String {
+    StrBuf *buf;
+    // the bytes of the string, in buf
+    const char *bytes;
+    size_t size;
+    // characters, size when all ASCII
+    size_t length;
+} String;
+
+typedef struct Builder {
+    StrBuf *buf;
+    size_t length;
+} Builder;
+
+#define string_of(x)    ((String*)(x)->val)
+#define string_bytes(x) (string_of(x)->bytes)
+#define string_size(x)  (string_of(x)->size)
+
+// copies the bytes
+String *string_new(const char *bytes, size_t size);
+Cell *make_string(const char *bytes, size_t size);
+#define make_cstring(s) make_string(s, strlen(s))
+// declares name, a NUL terminated copy of x on the stack, for C functions
+#define string_local(name, x)                                           \
+    char name[string_size(x) + 1];                                      \
+    memcpy(name, string_bytes(x), string_size(x));                      \
+    name[string_size(x)] = '\0'
+bool string_equal(Cell *x, Cell *y);
+// called by the collector on dead cells
+void string_free(String *s);
+
+size_t string_length(Cell *x);
+// characters start to end, raises when they are not in x
+Cell *substring(Cell *x, long start, long end);
+Cell *string_append(int argc, Cell **argv);
+// the index of the first pattern in x from start on, or nil
+Cell *string_search(Cell *x, Cell *pattern, long start);
+// the parts of x between the separators, "" between two in a row
+Cell *string_split(Cell *x, Cell *separator);
+
+Builder *builder_new(const char *bytes, size_t size);
+Cell *make_builder(void);
+Cell *builder_add(Cell *builder, Cell *x);
+Cell *builder_string(Cell *builder);
+void builder_free(Builder *b);
+
+#endif
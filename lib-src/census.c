@@ -0,0 +1,290 @@
+#include "census.h"
+#include "stats.h"
+#include "text.h"
+
+volatile sig_atomic_t census_requested = 0;
+
+// Owners are kept in moveTo while the census runs: the global env and
+// symbol table structure, cells shared between roots, or root i + 3.
+#define OWNER_ENV    ((void*)1)
+#define OWNER_SHARED ((void*)2)
+#define owner_tag(i) ((void*)(uintptr_t)((i) + 3))
+#define tag_owner(x) ((size_t)(uintptr_t)(x) - 3)
+
+typedef struct {
+    Cell *cell;
+    bool shared;
+} Pending;
+
+typedef struct {
+    Pending *items;
+    size_t size;
+    size_t capacity;
+} Worklist;
+
+static void push(Worklist *work, Cell *cell, bool shared) {
+    if (work->size == work->capacity) {
+        work->capacity = work->capacity ? 2 * work->capacity : 256;
+        work->items = realloc(work->items, work->capacity * sizeof(Pending));
+    }
+    work->items[work->size++] = (Pending){cell, shared};
+}
+
+// Tags everything reachable from cell that no other root reached with
+// owner. What another root reached already becomes shared, and so does
+// everything below it. The global env is never entered again.
+static void claim(VM *vm, Worklist *work, Cell *cell, void *owner) {
+    push(work, cell, false);
+    while (work->size > 0) {
+        Pending next = work->items[--work->size];
+        Cell *x = next.cell;
+        if (!in_heap(vm, x)) continue;
+        void *tag = x->moveTo;
+        if (tag == OWNER_ENV || tag == OWNER_SHARED) continue;
+        if (next.shared || (tag != NULL && tag != owner)) {
+            x->moveTo = OWNER_SHARED;
+            next.shared = true;
+        } else if (tag == owner) {
+            continue;
+        } else {
+            x->moveTo = owner;
+        }
+        if (has_refs(x)) {
+            push(work, car(x), next.shared);
+            push(work, cdr(x), next.shared);
+        }
+    }
+}
+
+// what a cell points to outside of the heap
+static size_t payload_bytes(Cell *x) {
+    switch (x->type) {
+    case TypeString:
+        // the bytes are counted for every slice sharing them
+        return sizeof(String) + string_size(x);
+    case TypeBuilder:
+        return sizeof(Builder) + ((Builder*)x->val)->buf->capacity;
+    case TypeSymbol:
+    case TypeError:
+        return x->val ? strlen(x->val) + 1 : 0;
+    case TypeFloat:
+        return sizeof(float);
+    default:
+        return 0;
+    }
+}
+
+static int by_bytes(const void *x, const void *y) {
+    size_t a = ((Retained*)x)->bytes, b = ((Retained*)y)->bytes;
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+void heap_census(VM *vm, Census *census) {
+    memset(census, 0, sizeof(Census));
+    census->heapCells = vm->next - vm->heap;
+
+    // the global env and the symbol table belong to no root in particular
+    dolist_cdr(sym, vm->symbols) {
+        sym->moveTo = OWNER_ENV;
+        if (in_heap(vm, car(sym)))
+            ((Cell*)car(sym))->moveTo = OWNER_ENV;
+    }
+    heap_seal(vm);
+    // the stacks and the region frames of the threads
+    size_t numRoots = 0;
+    Mutator *m;
+    for (int k = 0; (m = mutator_at(vm, k)) != NULL; k++) {
+        numRoots += m->stackSize + 1;
+    }
+    for (int i = 0; i < vm->rootsSize; i++) {
+        numRoots += vm->rootCounts[i];
+    }
+    if (!null(vm->globals)) {
+        vm->globals->moveTo = OWNER_ENV;
+        dolist_cdr(binding, car(vm->globals)) {
+            binding->moveTo = OWNER_ENV;
+            ((Cell*)car(binding))->moveTo = OWNER_ENV;
+            numRoots++;
+        }
+    }
+
+    Retained *roots = calloc(numRoots + 1, sizeof(Retained));
+    Worklist work = {0};
+    size_t n = 0;
+    if (!null(vm->globals)) {
+        dolist_cdr(binding, car(vm->globals)) {
+            Cell *pair = car(binding);
+            roots[n].label = ((Cell*)car(pair))->val;
+            claim(vm, &work, cdr(pair), owner_tag(n));
+            n++;
+        }
+    }
+    for (int k = 0; (m = mutator_at(vm, k)) != NULL; k++) {
+        for (int i = 0; i < m->stackSize; i++, n++) {
+            roots[n].label = "[stack]";
+            claim(vm, &work, m->stack[i], owner_tag(n));
+        }
+        // the frames are not in the heap, what they bind is
+        roots[n].label = "[frames]";
+        for (Cell *c = m->region; c < m->regionNext; c++) {
+            claim(vm, &work, car(c), owner_tag(n));
+            claim(vm, &work, cdr(c), owner_tag(n));
+        }
+        n++;
+    }
+    for (int i = 0; i < vm->rootsSize; i++) {
+        for (int j = 0; j < vm->rootCounts[i]; j++, n++) {
+            roots[n].label = "[c-root]";
+            claim(vm, &work, vm->roots[i][j], owner_tag(n));
+        }
+    }
+    free(work.items);
+
+    // one pass over the heap counts and clears the tags
+    census->shared.label = "[shared]";
+    for (Cell *x = vm->heap; x < vm->next; x++) {
+        void *tag = x->moveTo;
+        if (tag == NULL) continue;
+        x->moveTo = NULL;
+
+        size_t bytes = sizeof(Cell) + payload_bytes(x);
+        census->liveCells++;
+        census->liveBytes += bytes;
+        census->cells[x->type]++;
+        census->bytes[x->type] += bytes;
+        Retained *owner = tag == OWNER_ENV ? NULL
+            : tag == OWNER_SHARED ? &census->shared
+            : &roots[tag_owner(tag)];
+        if (owner) {
+            owner->cells++;
+            owner->bytes += bytes;
+        }
+    }
+
+    qsort(roots, numRoots, sizeof(Retained), by_bytes);
+    for (size_t i = 0; i < numRoots && i < CENSUS_TOP; i++) {
+        if (roots[i].cells == 0) break;
+        census->top[census->topSize++] = roots[i];
+    }
+    free(roots);
+}
+
+static int by_count(const void *x, const void *y) {
+    unsigned long a = ((AllocSite*)x)->count, b = ((AllocSite*)y)->count;
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+static int by_name(const void *x, const void *y) {
+    return strcmp(((AllocSite*)x)->name, ((AllocSite*)y)->name);
+}
+
+// The sampled sites by name, most allocating first. Call sites within one
+// C function are merged. NULL without LISP_STATS.
+static AllocSite *sorted_sites(VM *vm, size_t *size) {
+    const Stats *stats = lisp_stats(vm);
+    *size = 0;
+    if (stats == NULL || stats->sitesSize == 0) return NULL;
+    AllocSite *sites = malloc(stats->sitesSize * sizeof(AllocSite));
+    size_t n = 0;
+    for (size_t i = 0; i < stats->sitesCapacity; i++) {
+        if (stats->sites[i].count == 0) continue;
+        sites[n] = stats->sites[i];
+        sites[n].name = stats_site_name(&stats->sites[i]);
+        sites[n].caller = NULL;
+        n++;
+    }
+    qsort(sites, n, sizeof(AllocSite), by_name);
+    for (size_t i = 0; i < n; i++) {
+        if (*size > 0 && string_eq(sites[*size - 1].name, sites[i].name))
+            sites[*size - 1].count += sites[i].count;
+        else
+            sites[(*size)++] = sites[i];
+    }
+    qsort(sites, *size, sizeof(AllocSite), by_count);
+    return sites;
+}
+
+void census_dump(VM *vm, FILE *out) {
+    Census census;
+    heap_census(vm, &census);
+
+    fprintf(out, "heap census: %zu cells in use, %zu live (%zu bytes)\n",
+            census.heapCells, census.liveCells, census.liveBytes);
+    for (int t = 0; t < TypeCount; t++) {
+        if (census.cells[t])
+            fprintf(out, "  %-12s %10zu cells %12zu bytes\n", type_name(t),
+                    census.cells[t], census.bytes[t]);
+    }
+
+    size_t size = 0;
+    AllocSite *sites = sorted_sites(vm, &size);
+    if (sites) {
+        fprintf(out, "allocation sites (estimated from 1 in %d):\n",
+                ALLOC_SAMPLE_PERIOD);
+        for (size_t i = 0; i < size && i < CENSUS_TOP; i++) {
+            fprintf(out, "  %-24s %10lu\n", sites[i].name,
+                    sites[i].count * ALLOC_SAMPLE_PERIOD);
+        }
+        free(sites);
+    }
+
+    fprintf(out, "largest retained structures:\n");
+    for (int i = 0; i < census.topSize; i++) {
+        fprintf(out, "  %-24s %10zu cells %12zu bytes\n", census.top[i].label,
+                census.top[i].cells, census.top[i].bytes);
+    }
+    fprintf(out, "  %-24s %10zu cells %12zu bytes\n", census.shared.label,
+            census.shared.cells, census.shared.bytes);
+}
+
+#define make_entry(name, val) cons(intern((char*)(name)), val)
+#define make_size(label, cells, bytes)                                  \
+    make_entry(label, cons(make_total(cells), make_total(bytes)))
+
+Cell *census_to_list(VM *vm) {
+    Census census;
+    heap_census(vm, &census);
+
+    Cell *types = nil();
+    for (int t = TypeCount - 1; t >= 0; t--) {
+        if (census.cells[t])
+            types = cons(make_size(type_name(t), census.cells[t],
+                                   census.bytes[t]), types);
+    }
+
+    Cell *sites = nil();
+    size_t size = 0;
+    AllocSite *sorted = sorted_sites(vm, &size);
+    for (size_t i = size; i > 0; i--) {
+        sites = cons(make_entry(sorted[i - 1].name,
+                                make_total(sorted[i - 1].count
+                                           * ALLOC_SAMPLE_PERIOD)), sites);
+    }
+    free(sorted);
+
+    Cell *retained = cons(make_size(census.shared.label, census.shared.cells,
+                                    census.shared.bytes), nil());
+    for (int i = census.topSize - 1; i >= 0; i--) {
+        retained = cons(make_size(census.top[i].label, census.top[i].cells,
+                                  census.top[i].bytes), retained);
+    }
+
+    return make_cCell(6,
+                      make_entry("heap-cells", make_total(census.heapCells)),
+                      make_entry("live-cells", make_total(census.liveCells)),
+                      make_entry("live-bytes", make_total(census.liveBytes)),
+                      make_entry("live-by-type", types),
+                      make_entry("allocation-sites", sites),
+                      make_entry("retained", retained));
+}
+
+static void request_census(int sig) {
+    census_requested = 1;
+}
+
+void census_on_signal(int sig) {
+    struct sigaction action = {.sa_handler = request_census,
+                               .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(sig, &action, NULL);
+}
@@ -0,0 +1,704 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include "compile.h"
+#include "condition.h"
+#include "reader.h"
+
+// how an expression's value is represented in C
+typedef enum { ValueCell, ValueInt, ValueBool } ValueType;
+
+typedef struct {
+    Cell *name;
+    Cell *params;
+    // the body as one form
+    Cell *body;
+    int arity;
+    // it has an int version, see compile.h
+    bool specialized;
+} Function;
+
+typedef struct {
+    FILE *out;
+    Function functions[COMPILE_FUNCTIONS_MAX];
+    int functionsSize;
+    // quoted data, symbols and numbers the code refers to, made when the
+    // object is loaded; constants[0] is t
+    Cell *constants;
+    int constantsSize;
+    // the function being emitted, and whether it is its int version
+    Function *fn;
+    bool intVersion;
+    int temps;
+} Compiler;
+
+static void emit(Compiler *c, Cell *x, ValueType want);
+
+static int param_index(Compiler *c, Cell *var) {
+    int i = 0;
+    dolist_cdr(param, c->fn->params) {
+        if (car(param) == var)
+            return i;
+        i++;
+    }
+    return -1;
+}
+
+static Function *find_function(Compiler *c, Cell *name) {
+    for (int i = 0; i < c->functionsSize; i++) {
+        if (c->functions[i].name == name)
+            return &c->functions[i];
+    }
+    return NULL;
+}
+
+// the function a call of op goes to directly
+static Function *callee(Compiler *c, Cell *op, int argc) {
+    if (!is_symbol(op) || param_index(c, op) >= 0)
+        return NULL;
+    Function *f = find_function(c, op);
+    return f && f->arity == argc ? f : NULL;
+}
+
+// a primitive the call of op is open coded as, argc given
+static bool is_open_coded(Compiler *c, Cell *op, char *name, int argc,
+                          int wanted) {
+    return is_symbol_named(op, name) && param_index(c, op) < 0
+        && (wanted < 0 || argc == wanted);
+}
+
+#define is_arith(c, op, argc)                                           \
+    (is_open_coded(c, op, "+", argc, -1) || is_open_coded(c, op, "*", argc, -1) \
+     || (is_open_coded(c, op, "-", argc, -1) && argc > 0))
+#define is_compare(c, op, argc)                                         \
+    (is_open_coded(c, op, "=", argc, 2) || is_open_coded(c, op, "<", argc, 2))
+
+// whether the head of x is a special form rather than an operator
+static bool is_special(Cell *x) {
+    SpecialForm form = symbol_form((Cell*)car(x));
+    return form != FormNone && form != FormUnquote
+        && form != FormUnquoteSplicing;
+}
+
+static Cell *last(Cell *list) {
+    while (!null(cdr(list))) {
+        list = cdr(list);
+    }
+    return car(list);
+}
+
+static bool all_int(Compiler *c, Cell *args);
+
+static ValueType type_of(Compiler *c, Cell *x) {
+    if (is_integer(x))
+        return ValueInt;
+    if (null(x))
+        return ValueCell;
+    if (is_symbol(x))
+        return c->intVersion && param_index(c, x) >= 0 ? ValueInt : ValueCell;
+    if (!is_pair(x))
+        return ValueCell;
+    if (is_special(x)) {
+        switch (symbol_form((Cell*)car(x))) {
+        case FormIf: {
+            ValueType conseq = type_of(c, caddr(x));
+            ValueType alt = null(cdr(cddr(x)))
+                ? ValueCell : type_of(c, car(cdr(cddr(x))));
+            return conseq == alt ? conseq : ValueCell;
+        }
+        case FormSequence:
+            return null(cdr(x)) ? ValueCell : type_of(c, last(x));
+        default:
+            return ValueCell;
+        }
+    }
+    Cell *op = car(x);
+    int argc = length(cdr(x));
+    if (is_arith(c, op, argc))
+        return ValueInt;
+    if (is_compare(c, op, argc) || is_open_coded(c, op, "eq", argc, 2))
+        return ValueBool;
+    Function *f = callee(c, op, argc);
+    return f && f->specialized && all_int(c, cdr(x)) ? ValueInt : ValueCell;
+}
+
+static bool all_int(Compiler *c, Cell *args) {
+    dolist_cdr(arg, args) {
+        if (type_of(c, car(arg)) != ValueInt)
+            return false;
+    }
+    return true;
+}
+
+// Only the forms the emitter knows, a proper list where a call is.
+static bool compilable(Cell *x) {
+    if (!is_pair(x))
+        return true;
+    int n = length(x);
+    for (Cell *rest = x; !null(rest); rest = cdr(rest)) {
+        if (!is_pair(rest))
+            return false;
+    }
+    if (is_special(x)) {
+        switch (symbol_form((Cell*)car(x))) {
+        case FormQuote:
+            return n == 2;
+        case FormIf:
+            if (n != 3 && n != 4)
+                return false;
+            break;
+        case FormAssignment:
+            return n == 3 && is_symbol((Cell*)cadr(x)) && compilable(caddr(x));
+        case FormSequence:
+            break;
+        default:
+            return false;
+        }
+    }
+    dolist_cdr(e, x) {
+        if (!compilable(car(e)))
+            return false;
+    }
+    return true;
+}
+
+// whether it set!s one of params
+static bool assigns(Cell *x, Cell *params) {
+    if (!is_pair(x) || symbol_form((Cell*)car(x)) == FormQuote)
+        return false;
+    if (symbol_form((Cell*)car(x)) == FormAssignment) {
+        dolist_cdr(param, params) {
+            if (car(param) == cadr(x))
+                return true;
+        }
+    }
+    dolist_cdr(e, x) {
+        if (assigns(car(e), params))
+            return true;
+    }
+    return false;
+}
+
+static int constant(Compiler *c, Cell *x) {
+    int i = 0;
+    dolist_cdr(k, c->constants) {
+        if (car(k) == x)
+            return c->constantsSize - 1 - i;
+        i++;
+    }
+    c->constants = cons(x, c->constants);
+    return c->constantsSize++;
+}
+
+static void emit_bytes(FILE *out, const char *bytes, size_t size) {
+    fputc('"', out);
+    for (size_t i = 0; i < size; i++) {
+        unsigned char ch = bytes[i];
+        if (ch == '"' || ch == '\\')
+            fprintf(out, "\\%c", ch);
+        else if (ch < ' ' || ch > '~')
+            fprintf(out, "\\%03o", ch);
+        else
+            fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+static void emit_string(FILE *out, char *s) {
+    emit_bytes(out, s, strlen(s));
+}
+
+// C that makes the constant x again
+static void emit_constant(FILE *out, Cell *x) {
+    if (null(x)) {
+        fprintf(out, "nil()");
+    } else if (is_symbol(x)) {
+        fprintf(out, "intern(");
+        emit_string(out, (char*)x->val);
+        fprintf(out, ")");
+    } else if (is_integer(x)) {
+        fprintf(out, "make_int(%d)", int_val(x));
+    } else if (is_float(x)) {
+        fprintf(out, "compiled_float(%a)", *(float*)x->val);
+    } else if (is_string(x)) {
+        fprintf(out, "make_string(");
+        emit_bytes(out, string_bytes(x), string_size(x));
+        fprintf(out, ", %zu)", string_size(x));
+    } else if (is_pair(x)) {
+        fprintf(out, "cons(");
+        emit_constant(out, car(x));
+        fprintf(out, ", ");
+        emit_constant(out, cdr(x));
+        fprintf(out, ")");
+    } else {
+        fprintf(out, "nil()");
+    }
+}
+
+static void emit_quoted(Compiler *c, Cell *x) {
+    if (null(x))
+        fprintf(c->out, "nil()");
+    else
+        fprintf(c->out, "constants[%d]", constant(c, x));
+}
+
+static void emit_variable(Compiler *c, Cell *x) {
+    int i = param_index(c, x);
+    if (i >= 0) {
+        fprintf(c->out, "p%d", i);
+        return;
+    }
+    fprintf(c->out, "compiled_global(");
+    emit_quoted(c, x);
+    fprintf(c->out, ")");
+}
+
+// Opens "({ T tN = arg; ..." with a temporary for each argument, so they
+// are evaluated left to right like the interpreter does. Returns the
+// first N, the caller uses them and closes the block.
+static int emit_temps(Compiler *c, Cell *args, ValueType want) {
+    fprintf(c->out, "({ ");
+    // the arguments may use temporaries of their own
+    int first = c->temps;
+    int i = first;
+    c->temps += length(args);
+    dolist_cdr(arg, args) {
+        fprintf(c->out, "%st%d = ", want == ValueInt ? "int " : "Cell *",
+                i++);
+        emit(c, car(arg), want);
+        fprintf(c->out, "; ");
+    }
+    return first;
+}
+
+static void emit_temp_list(Compiler *c, int first, int argc, char *sep) {
+    for (int i = 0; i < argc; i++) {
+        fprintf(c->out, "%st%d", i > 0 ? sep : "", first + i);
+    }
+}
+
+static void emit_call(Compiler *c, Cell *x, ValueType type) {
+    Cell *op = car(x);
+    Cell *args = cdr(x);
+    int argc = length(args);
+    Function *f = callee(c, op, argc);
+    if (is_arith(c, op, argc)) {
+        char *name = (char*)op->val;
+        if (argc == 0) {
+            fprintf(c->out, "%s", string_eq(name, "*") ? "1" : "0");
+            return;
+        }
+        int first = emit_temps(c, args, ValueInt);
+        if (argc == 1 && string_eq(name, "-"))
+            fprintf(c->out, "-");
+        emit_temp_list(c, first, argc, string_eq(name, "+") ? " + "
+                       : string_eq(name, "*") ? " * " : " - ");
+        fprintf(c->out, "; })");
+    } else if (is_compare(c, op, argc)) {
+        int first = emit_temps(c, args, ValueInt);
+        emit_temp_list(c, first, argc,
+                       is_symbol_named(op, "=") ? " == " : " < ");
+        fprintf(c->out, "; })");
+    } else if (is_open_coded(c, op, "eq", argc, 2)) {
+        // an unboxed int has no cell to be the same as, its value is
+        // compared; boxing it would make a new one
+        ValueType left = type_of(c, car(args));
+        ValueType right = type_of(c, cadr(args));
+        if (left == ValueInt && right == ValueInt) {
+            int first = emit_temps(c, args, ValueInt);
+            emit_temp_list(c, first, argc, " == ");
+            fprintf(c->out, "; })");
+        } else if (left == ValueInt || right == ValueInt) {
+            int first = emit_temps(c, args, ValueCell);
+            fprintf(c->out, "compiled_eq_int(");
+            emit_temp_list(c, first, argc, ", ");
+            fprintf(c->out, "); })");
+        } else {
+            int first = emit_temps(c, args, ValueCell);
+            emit_temp_list(c, first, argc, " == ");
+            fprintf(c->out, "; })");
+        }
+    } else if (is_open_coded(c, op, "cons", argc, 2)) {
+        int first = emit_temps(c, args, ValueCell);
+        fprintf(c->out, "cons(");
+        emit_temp_list(c, first, argc, ", ");
+        fprintf(c->out, "); })");
+    } else if (is_open_coded(c, op, "car", argc, 1)
+               || is_open_coded(c, op, "cdr", argc, 1)) {
+        fprintf(c->out, "compiled_%s(", (char*)op->val);
+        emit(c, car(args), ValueCell);
+        fprintf(c->out, ")");
+    } else if (f != NULL) {
+        bool unboxed = type == ValueInt;
+        int first = emit_temps(c, args, unboxed ? ValueInt : ValueCell);
+        fprintf(c->out, "fn%d%s(", (int)(f - c->functions),
+                unboxed ? "_int" : "");
+        emit_temp_list(c, first, argc, ", ");
+        fprintf(c->out, "); })");
+    } else {
+        // through apply, like the interpreter; applying nil gives nil
+        int fn = c->temps++;
+        fprintf(c->out, "({ Cell *t%d = ", fn);
+        emit(c, op, ValueCell);
+        fprintf(c->out, "; null(t%d) ? nil() : ", fn);
+        int first = emit_temps(c, args, ValueCell);
+        fprintf(c->out, "Cell *argv[] = {");
+        emit_temp_list(c, first, argc, ", ");
+        fprintf(c->out, "%snil()}; apply_argv(t%d, %d, argv); }); })",
+                argc > 0 ? ", " : "", fn, argc);
+    }
+}
+
+// x in the representation type_of gives it
+static void emit_value(Compiler *c, Cell *x, ValueType type) {
+    if (is_integer(x)) {
+        fprintf(c->out, "%d", int_val(x));
+    } else if (null(x)) {
+        fprintf(c->out, "nil()");
+    } else if (is_symbol(x)) {
+        emit_variable(c, x);
+    } else if (!is_pair(x)) {
+        emit_quoted(c, x);
+    } else if (!is_special(x)) {
+        emit_call(c, x, type);
+    } else {
+        switch (symbol_form((Cell*)car(x))) {
+        case FormQuote:
+            emit_quoted(c, cadr(x));
+            break;
+        case FormIf:
+            fprintf(c->out, "(");
+            emit(c, cadr(x), ValueBool);
+            fprintf(c->out, " ? ");
+            emit(c, caddr(x), type);
+            fprintf(c->out, " : ");
+            if (null(cdr(cddr(x))))
+                fprintf(c->out, "nil()");
+            else
+                emit(c, car(cdr(cddr(x))), type);
+            fprintf(c->out, ")");
+            break;
+        case FormSequence:
+            if (null(cdr(x))) {
+                fprintf(c->out, "nil()");
+                break;
+            }
+            fprintf(c->out, "(");
+            dolist_cdr(e, cdr(x)) {
+                bool isLast = null(cdr(e));
+                emit(c, car(e), isLast ? type : ValueCell);
+                fprintf(c->out, isLast ? ")" : ", ");
+            }
+            break;
+        case FormAssignment: {
+            int i = param_index(c, cadr(x));
+            if (i >= 0) {
+                fprintf(c->out, "(p%d = ", i);
+            } else {
+                fprintf(c->out, "env_set_variable_value(");
+                emit_quoted(c, cadr(x));
+                fprintf(c->out, ", ");
+            }
+            emit(c, caddr(x), ValueCell);
+            fprintf(c->out, i >= 0 ? ")" : ", getVM()->globals)");
+            break;
+        }
+        default:
+            // compilable() lets no other form through
+            fprintf(c->out, "nil()");
+        }
+    }
+}
+
+static void emit(Compiler *c, Cell *x, ValueType want) {
+    ValueType type = type_of(c, x);
+    if (type == want) {
+        emit_value(c, x, type);
+    } else if (want == ValueCell && is_integer(x)) {
+        emit_quoted(c, x);
+    } else if (want == ValueCell) {
+        fprintf(c->out, type == ValueInt ? "make_int(" : "(");
+        emit_value(c, x, type);
+        fprintf(c->out, type == ValueInt ? ")" : " ? constants[0] : nil())");
+    } else if (want == ValueInt) {
+        // a bool is t or nil, neither is an integer
+        fprintf(c->out, "compiled_int(");
+        emit(c, x, ValueCell);
+        fprintf(c->out, ")");
+    } else {
+        fprintf(c->out, type == ValueInt ? "(" : "!null(");
+        emit_value(c, x, type);
+        fprintf(c->out, type == ValueInt ? ", 1)" : ")");
+    }
+}
+
+static void emit_signature(Compiler *c, Function *f, bool intVersion) {
+    int i = f - c->functions;
+    char *type = intVersion ? "int " : "Cell *";
+    fprintf(c->out, "static %sfn%d%s(", type, i, intVersion ? "_int" : "");
+    for (int p = 0; p < f->arity; p++) {
+        fprintf(c->out, "%s%sp%d", p > 0 ? ", " : "", type, p);
+    }
+    if (f->arity == 0)
+        fprintf(c->out, "void");
+    fprintf(c->out, ")");
+}
+
+static void emit_function(Compiler *c, Function *f, bool intVersion) {
+    c->fn = f;
+    c->intVersion = intVersion;
+    c->temps = 0;
+    emit_signature(c, f, intVersion);
+    fprintf(c->out, " {\n    compiled_poll();\n    return ");
+    emit(c, f->body, intVersion ? ValueInt : ValueCell);
+    fprintf(c->out, ";\n}\n\n");
+}
+
+// The primitive a compiled procedure is bound to, it takes the int
+// version when every argument is an integer.
+static void emit_prim(Compiler *c, Function *f) {
+    int i = f - c->functions;
+    fprintf(c->out, "static Cell *prim%d(int argc, Cell **argv) {\n", i);
+    if (f->specialized) {
+        fprintf(c->out, "    if (");
+        for (int p = 0; p < f->arity; p++) {
+            fprintf(c->out, "%sis_integer(argv[%d])", p > 0 ? " && " : "", p);
+        }
+        fprintf(c->out, ")\n        return make_int(fn%d_int(", i);
+        for (int p = 0; p < f->arity; p++) {
+            fprintf(c->out, "%sint_val(argv[%d])", p > 0 ? ", " : "", p);
+        }
+        fprintf(c->out, "));\n");
+    }
+    fprintf(c->out, "    return fn%d(", i);
+    for (int p = 0; p < f->arity; p++) {
+        fprintf(c->out, "%sargv[%d]", p > 0 ? ", " : "", p);
+    }
+    fprintf(c->out, ");\n}\n\n");
+}
+
+// Starts from every procedure with parameters having an int version and
+// drops those whose body is not an int, until none changes. A parameter
+// of the int version used as a cell is boxed again.
+static void specialize(Compiler *c) {
+    for (int i = 0; i < c->functionsSize; i++) {
+        Function *f = &c->functions[i];
+        f->specialized = f->arity > 0 && !assigns(f->body, f->params);
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < c->functionsSize; i++) {
+            Function *f = &c->functions[i];
+            if (!f->specialized)
+                continue;
+            c->fn = f;
+            c->intVersion = true;
+            if (type_of(c, f->body) != ValueInt) {
+                f->specialized = false;
+                changed = true;
+            }
+        }
+    }
+}
+
+static void emit_file(Compiler *c, char *src) {
+    fprintf(c->out, "// compiled from %s by compile-file\n\n", src);
+    fprintf(c->out, "#include \"compile.h\"\n\n");
+    // the constants are only known once the code is emitted
+    char *code = NULL;
+    size_t size = 0;
+    FILE *out = c->out;
+    c->out = open_memstream(&code, &size);
+    for (int i = 0; i < c->functionsSize; i++) {
+        emit_signature(c, &c->functions[i], false);
+        fprintf(c->out, ";\n");
+        if (c->functions[i].specialized) {
+            emit_signature(c, &c->functions[i], true);
+            fprintf(c->out, ";\n");
+        }
+    }
+    fprintf(c->out, "\n");
+    for (int i = 0; i < c->functionsSize; i++) {
+        Function *f = &c->functions[i];
+        fprintf(c->out, "// ");
+        fprint_expr(c->out, f->name);
+        fprintf(c->out, "\n");
+        emit_function(c, f, false);
+        if (f->specialized)
+            emit_function(c, f, true);
+        emit_prim(c, f);
+    }
+    fclose(c->out);
+    c->out = out;
+
+    fprintf(c->out, "static Cell *constants[%d];\n\n", c->constantsSize);
+    fputs(code, c->out);
+    free(code);
+
+    fprintf(c->out, "static const PrimDef prims[] = {\n");
+    for (int i = 0; i < c->functionsSize; i++) {
+        Function *f = &c->functions[i];
+        fprintf(c->out, "    {");
+        emit_string(c->out, (char*)f->name->val);
+        fprintf(c->out, ", prim%d, %d, %d},\n", i, f->arity, f->arity);
+    }
+    fprintf(c->out, "};\n\n");
+
+    fprintf(c->out, "int lisp_extension_init(VM *vm, int apiVersion) {\n"
+            "    if (apiVersion != EXTENSION_API_VERSION)\n"
+            "        return 1;\n");
+    // the list has the last constant first
+    Cell *k = c->constants;
+    for (int i = c->constantsSize - 1; i >= 0; i--, k = cdr(k)) {
+        fprintf(c->out, "    constants[%d] = ", i);
+        emit_constant(c->out, car(k));
+        fprintf(c->out, ";\n");
+    }
+    fprintf(c->out, "    ext_gc_root_array(vm, constants, %d);\n"
+            "    for (int i = 0; i < %d; i++) {\n"
+            "        ext_define_prim(vm, &prims[i]);\n"
+            "    }\n"
+            "    return 0;\n"
+            "}\n", c->constantsSize, c->functionsSize);
+}
+
+static bool proper_params(Cell *params) {
+    for (; is_pair(params); params = cdr(params)) {
+        if (!is_symbol((Cell*)car(params)))
+            return false;
+    }
+    return null(params);
+}
+
+// (define (name params...) body...), a later one replaces an earlier one
+static void add_function(Compiler *c, Cell *form) {
+    Cell *target = cadr(form);
+    Cell *name = car(target);
+    Cell *body = cddr(form);
+    if (!is_symbol(name) || !proper_params(cdr(target)) || !is_pair(body))
+        return;
+    dolist_cdr(e, body) {
+        expand_macros(car(e), getVM()->globals);
+    }
+    Cell *form_body = null(cdr(body)) ? car(body) : cons(intern("begin"), body);
+    Function *f = find_function(c, name);
+    if (!compilable(form_body)) {
+        if (f != NULL)
+            *f = c->functions[--c->functionsSize];
+        return;
+    }
+    if (f == NULL) {
+        if (c->functionsSize == COMPILE_FUNCTIONS_MAX)
+            raise_error("more than %d procedures", COMPILE_FUNCTIONS_MAX);
+        f = &c->functions[c->functionsSize++];
+    }
+    *f = (Function){.name = name, .params = cdr(target), .body = form_body,
+                    .arity = length(cdr(target))};
+}
+
+static Cell *read_forms(char *src) {
+    FILE *input = fopen(src, "r");
+    if (input == NULL)
+        raise_error("cannot open %s", src);
+    Mutator *m = getMutator();
+    Handler handler;
+    if (handler_enter(m, &handler) != 0) {
+        fclose(input);
+        lisp_raise(handler.condition);
+    }
+    Cell *forms = nil();
+    Cell *form;
+    Cell **tail = &forms;
+    while ((form = lisp_read(input)) != NULL) {
+        *tail = cons(form, nil());
+        tail = &cdr(*tail);
+    }
+    handler_leave(m, &handler);
+    fclose(input);
+    return forms;
+}
+
+// the C file next to out
+static char *c_path(char *out) {
+    size_t n = strlen(out);
+    char *path = malloc(n + 3);
+    strcpy(path, out);
+    if (n > 3 && string_eq(path + n - 3, ".so"))
+        path[n - 3] = '\0';
+    strcat(path, ".c");
+    return path;
+}
+
+// words of LISP_CC, then the compiler's arguments, and the NULL ending them
+#define CC_ARGS_MAX 64
+
+// Runs LISP_CC on cPath without a shell: the paths come from the Lisp
+// code calling compile-file, anything in them is a path.
+static bool run_cc(char *cPath, char *out) {
+    char cc[] = LISP_CC;
+    char *argv[CC_ARGS_MAX];
+    int argc = 0;
+    char *save = NULL;
+    for (char *word = strtok_r(cc, " ", &save);
+         word != NULL && argc < CC_ARGS_MAX - 5;
+         word = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = word;
+    }
+    argv[argc++] = "-I" LISP_INCLUDE_DIR;
+    argv[argc++] = "-o";
+    argv[argc++] = out;
+    argv[argc++] = cPath;
+    argv[argc] = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void build(Compiler *c, char *src, char *out) {
+    char *cPath = c_path(out);
+    c->out = fopen(cPath, "w");
+    if (c->out == NULL) {
+        free(cPath);
+        raise_error("cannot write %s", out);
+    }
+    emit_file(c, src);
+    fclose(c->out);
+
+    bool built = run_cc(cPath, out);
+    free(cPath);
+    if (!built)
+        raise_error("cannot compile %s", src);
+}
+
+Cell *compile_file(char *src, char *out) {
+    Compiler c = {.constants = nil()};
+    constant(&c, lisp_true);
+    VM *vm = getVM();
+    dolist_cdr(form, read_forms(src)) {
+        Cell *x = car(form);
+        if (!is_pair(x) || !is_pair(cdr(x)))
+            continue;
+        SpecialForm kind = symbol_form((Cell*)car(x));
+        if (kind == FormDefineMacro)
+            eval(x, vm->globals);
+        else if (kind == FormDefine && is_pair((Cell*)cadr(x)))
+            add_function(&c, x);
+    }
+    specialize(&c);
+    build(&c, src, out);
+
+    char *err = load_extension(out);
+    if (err != NULL)
+        raise_error("cannot load %s, %s", out, err);
+    Cell *names = nil();
+    for (int i = c.functionsSize - 1; i >= 0; i--) {
+        names = cons(c.functions[i].name, names);
+    }
+    return names;
+}
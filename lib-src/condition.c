@@ -0,0 +1,63 @@
+#include "condition.h"
+#include "reader.h"
+
+void handler_push(Mutator *m, Handler *h) {
+    h->prev = m->handler;
+    h->stackSize = m->stackSize;
+    h->shadowDepth = m->shadowDepth;
+    h->regionNext = m->regionNext;
+    h->condition = NULL;
+    m->handler = h;
+}
+
+// the message is copied
+Cell *make_error(char *msg) {
+    return make_cell(TypeError, strdup(msg));
+}
+
+void lisp_interrupt(VM *vm, int reason) {
+    __atomic_store_n(&vm->interrupt, reason, __ATOMIC_RELAXED);
+}
+
+void lisp_interrupted(VM *vm) {
+    if (__atomic_load_n(&vm->interrupt, __ATOMIC_RELAXED) == INTERRUPT_MEMORY)
+        raise_error("%s", "interrupted, allocated too much");
+    raise_error("%s", "interrupted, out of time");
+}
+
+// Roots registered by the frames being unwound point between the raise
+// and the handler on the C stack, which grows down. Roots in static
+// storage stay, whichever frame registered them. Other threads change the
+// roots as well, see ext_gc_root_array.
+static void unwind_roots(VM *vm, Handler *h, void *top) {
+    pthread_mutex_lock(&vm->lock);
+    for (int i = 0; i < vm->rootsSize; i++) {
+        void *ref = vm->roots[i];
+        if (ref >= top && ref < (void*)h) {
+            vm->rootsSize--;
+            vm->roots[i] = vm->roots[vm->rootsSize];
+            vm->rootCounts[i--] = vm->rootCounts[vm->rootsSize];
+        }
+    }
+    pthread_mutex_unlock(&vm->lock);
+}
+
+void lisp_raise(Cell *condition) {
+    VM *vm = getVM();
+    Mutator *m = getMutator();
+    Handler *h = m->handler;
+    if (h == NULL) {
+        fprintf(stderr, "uncaught condition, ");
+        fprint_expr(stderr, condition);
+        fprintf(stderr, "\n");
+        exit(1);
+    }
+    int top;
+    unwind_roots(vm, h, &top);
+    m->stackSize = h->stackSize;
+    m->shadowDepth = h->shadowDepth;
+    m->regionNext = h->regionNext;
+    m->handler = h->prev;
+    h->condition = condition;
+    longjmp(h->jump, 1);
+}
@@ -1,35 +1,125 @@
-
+#define _GNU_SOURCE
 #include <stdarg.h>
+#include <sys/mman.h>
 #include "data.h"
 #include "reader.h"
+#include "extension.h"
+#include "stats.h"
+#include "pool.h"
+#include "text.h"
 
 /* #define TODO(str) (printf("at %s: %s", __func__, str);) */
 #define TODO(str) ;
 
 
-static Cell sym_nil = {.type = TypeSymbol, .val = NULL, .next = NULL};
-static Cell *symbols = &sym_nil;
-static VM *global_vm = NULL; 
+// nil is the only cell shared between interpreters, nothing ever writes to
+// it (the GC leaves cells outside of its heap alone).
+static const Cell sym_nil = {.type = TypeSymbol, .val = "nil", .next = NULL};
 
-Cell *nil(void) { return &sym_nil; }
+// Integers from SMALL_INT_MIN to SMALL_INT_MAX, outside of any heap like
+// nil. They are filled in before main and only read afterwards.
+static Cell small_ints[SMALL_INT_MAX - SMALL_INT_MIN + 1];
 
-VM *getVM(void) {
-    if (global_vm == NULL) {
-        // Creates a new VM with an empty stack and an empty (but allocated) heap.
-        VM* vm = malloc(sizeof(VM));
-        vm->stackSize = 0;
-        vm->numObjs = 0;
+__attribute__((constructor)) static void init_small_ints(void) {
+    for (int n = SMALL_INT_MIN; n <= SMALL_INT_MAX; n++) {
+        small_ints[n - SMALL_INT_MIN] =
+            (Cell){.type = TypeInt, .val = (void*)(intptr_t)n};
+    }
+}
+
+// Every interpreter owns its VM. The one a thread is running is found
+// through this, with the thread's part of it, so that only the workers of
+// a VM share anything mutable.
+static _Thread_local VM *current_vm = NULL;
+static _Thread_local Mutator *current_mutator = NULL;
+
+Cell *nil(void) { return (Cell*)&sym_nil; }
+
+void mutator_init(Mutator *m) {
+    m->region = mmap(NULL, REGION_SIZE * sizeof(Cell), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m->region == MAP_FAILED) {
+        perror("Cannot reserve region");
+        exit(1);
+    }
+    m->regionNext = m->region;
+}
+
+void mutator_free(Mutator *m) {
+    munmap(m->region, REGION_SIZE * sizeof(Cell));
+}
+
+// Creates a new VM with an empty stack and an empty (but allocated) heap.
+VM *vm_new(void) {
+    VM* vm = calloc(1, sizeof(VM));
+    vm->bindExtPrims = true;
+    pthread_mutex_init(&vm->lock, NULL);
+#ifdef LISP_STATS
+    vm->stats = stats_new();
+    vm->main.stats = vm->stats;
+#endif
+
+    // Reserve the address space up front so the heap never moves; pages
+    // are only committed as the bump pointer reaches them.
+    vm->heap = mmap(NULL, HEAP_MAX * sizeof(Cell), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (vm->heap == MAP_FAILED) {
+        perror("Cannot reserve heap");
+        exit(1);
+    }
+    vm->next = vm->heap;
+    vm->gcThreshold = vm->heap + HEAP_SIZE;
+
+    mutator_init(&vm->main);
 
-        vm->heap = malloc(HEAP_SIZE);
-        vm->next = vm->heap;
+    vm->symbols = nil();
+    vm->globals = nil();
+    return vm;
+}
 
-        global_vm = vm;
+void vm_free(VM *vm) {
+    if (current_vm == vm) {
+        current_vm = NULL;
+        current_mutator = NULL;
     }
-    return global_vm;
+    pool_free(vm);
+    unload_extensions(vm);
+    stats_free(vm->stats);
+    munmap(vm->heap, HEAP_MAX * sizeof(Cell));
+    free(vm->holes);
+    mutator_free(&vm->main);
+    pthread_mutex_destroy(&vm->lock);
+    free(vm);
+}
+
+// Makes vm the one this thread runs, returns the previous one.
+VM *vm_switch(VM *vm) {
+    VM *prev = current_vm;
+    current_vm = vm;
+    current_mutator = vm ? &vm->main : NULL;
+    return prev;
+}
+
+void mutator_switch(VM *vm, Mutator *m) {
+    current_vm = vm;
+    current_mutator = m;
+}
+
+VM *getVM(void) {
+    // a thread that never picked an interpreter gets its own
+    if (current_vm == NULL)
+        vm_switch(vm_new());
+    return current_vm;
+}
+
+Mutator *getMutator(void) {
+    if (current_mutator == NULL)
+        getVM();
+    return current_mutator;
 }
 
 int usedCells(VM* vm) {
-    return ((vm->heap + HEAP_SIZE) - vm->next) / sizeof(Cell);
+    return vm->next - vm->heap;
 }
 
 inline bool null(Cell *x) {
@@ -46,48 +136,109 @@ bool is_number(Cell *x) {
 //
 
 // Marks [object] as being reachable and still (potentially) in use.
-void mark(Cell* cell) {
+void mark(VM* vm, Cell* cell) {
+    // Cells outside the heap (nil) are never moved, so they carry no mark.
     // If already marked, we're done. Check this first to avoid recursing
     // on cycles in the object graph.
-    if (cell->moveTo) return;
+    while (in_heap(vm, cell) && !cell->moveTo) {
+        // Any non-zero pointer indicates the object was reached. For no
+        // particular reason, we use the object's own address as the marked
+        // value.
+        cell->moveTo = cell;
 
-    // Any non-zero pointer indicates the object was reached. For no particular
-    // reason, we use the object's own address as the marked value.
-    cell->moveTo = cell;
+        if (!has_refs(cell)) return;
 
-    // Recurse into the object's fields.
-    if (is_pair(cell)) {
-        mark(car(cell));
-        mark(cdr(cell));
+        // Recurse into the car, loop on the cdr so long lists stay shallow.
+        mark(vm, car(cell));
+        cell = cdr(cell);
     }
 }
 
-// The mark phase of garbage collection. Starting at the roots (in this case,
-// just the stack), recursively walks all reachable objects in the VM.
+Mutator *mutator_at(VM *vm, int i) {
+    return i == 0 ? &vm->main : pool_mutator(vm, i - 1);
+}
+
+// The mark phase of garbage collection. Starting at the roots (the stacks,
+// the symbol table and the global env), recursively walks all reachable
+// objects in the VM.
 void markAll(VM* vm) {
-    for (int i = 0; i < vm->stackSize; i++) {
-        mark(vm->stack[i]);
+    Mutator *m;
+    for (int k = 0; (m = mutator_at(vm, k)) != NULL; k++) {
+        for (int i = 0; i < m->stackSize; i++) {
+            mark(vm, m->stack[i]);
+        }
+        // the frames of the calls being evaluated, see gc_eval
+        for (Cell *c = m->region; c < m->regionNext; c++) {
+            mark(vm, car(c));
+            mark(vm, cdr(c));
+        }
     }
+    for (int i = 0; i < vm->rootsSize; i++) {
+        for (int j = 0; j < vm->rootCounts[i]; j++) {
+            mark(vm, vm->roots[i][j]);
+        }
+    }
+    mark(vm, vm->symbols);
+    mark(vm, vm->globals);
 }
 
 
+// Cells before young are all taken as live, and their fields as roots,
+// so that only the ones from young on get collected.
+static void markBefore(VM* vm, Cell* young) {
+    for (Cell* c = vm->heap; c < young; c++) {
+        c->moveTo = c;
+    }
+    for (Cell* c = vm->heap; c < young; c++) {
+        if (has_refs(c)) {
+            mark(vm, car(c));
+            mark(vm, cdr(c));
+        }
+    }
+}
+
+// what a dead cell owns outside of the heap
+static void free_payload(Cell *x) {
+    if (is_string(x))
+        string_free(x->val);
+    else if (is_builder(x))
+        builder_free(x->val);
+    else if (is_port(x) && x->val)
+        fclose(x->val);
+}
+
 // Phase one of the LISP2 algorithm. Walks the entire heap and, for each live
-// object, calculates where it will end up after compaction has moved it.
+// object, calculates where it will end up after compaction has moved it,
+// and frees what the dead ones own.
+//
+// The pinned cells, in address order, stay where they are and the others
+// slide over and around them.
 //
 // Returns the address of the end of the live section of the heap after
-// compaction is done.
-void* calculateNewLocations(VM* vm) {
+// compaction is done, up to which the others are moved.
+static Cell *calculateNewLocations(VM* vm, Cell **pins, size_t pinned) {
     // Calculate the new locations of the objects in the heap.
     Cell* from = vm->heap;
     Cell* to = vm->heap;
+    size_t fromPin = 0, toPin = 0;
     while (from < vm->next) {
         Cell* object = from;
-        if (object->moveTo) {
+        if (fromPin < pinned && pins[fromPin] == object) {
+            object->moveTo = object;
+            fromPin++;
+        } else if (object->moveTo) {
+            // to never passes from, which is not pinned
+            for (; toPin < pinned && pins[toPin] <= to; toPin++) {
+                if (pins[toPin] == to)
+                    to++;
+            }
             object->moveTo = to;
 
             // We increase the destination address only when we pass a live object.
             // This effectively slides objects up on memory over dead ones.
             to ++;
+        } else {
+            free_payload(object);
         }
         from ++;
     }
@@ -104,22 +255,38 @@ void* calculateNewLocations(VM* vm) {
 // [object.moveTo] in the object itself, this needs to be able to find the
 // object. Doing this process before objects have been moved ensures we can
 // still find them by traversing the *old* pointers.
+#define forward(vm, x) (in_heap(vm, x) ? ((Cell*)(x))->moveTo : (void*)(x))
+
 void updateAllObjectPointers(VM* vm) {
-    // Walk the stack.
-    for (int i = 0; i < vm->stackSize; i++) {
+    // Walk the stacks.
+    Mutator *m;
+    for (int k = 0; (m = mutator_at(vm, k)) != NULL; k++) {
         // Update the pointer on the stack to point to the object's new compacted
         // location.
-        vm->stack[i] = vm->stack[i]->moveTo;
+        for (int i = 0; i < m->stackSize; i++) {
+            m->stack[i] = forward(vm, m->stack[i]);
+        }
+        for (Cell *c = m->region; c < m->regionNext; c++) {
+            c->val = forward(vm, c->val);
+            c->next = forward(vm, c->next);
+        }
     }
+    for (int i = 0; i < vm->rootsSize; i++) {
+        for (int j = 0; j < vm->rootCounts[i]; j++) {
+            vm->roots[i][j] = forward(vm, vm->roots[i][j]);
+        }
+    }
+    vm->symbols = forward(vm, vm->symbols);
+    vm->globals = forward(vm, vm->globals);
 
-    // Walk the heap, fixing fields in live pairs.
+    // Walk the heap, fixing fields in live pairs and procedures.
     Cell* from = vm->heap;
     while (from < vm->next) {
         Cell* object = (Cell*)from;
 
-        if (object->moveTo && is_pair(object)) {
-            object->val = ((Cell*)object->val)->moveTo;
-            object->next = object->next->moveTo;
+        if (object->moveTo && has_refs(object)) {
+            object->val = forward(vm, object->val);
+            object->next = forward(vm, object->next);
         }
 
         from += 1;
@@ -147,117 +314,392 @@ void compact(VM* vm) {
     }
 }
 
-// Free memory for all unused objects.
-void gc(VM* vm) {
+// The cells between the ones moved and the pinned ones past them were
+// moved or dead. They are made empty like a sealed TLAB, and the VM's own
+// thread allocates from them before the end of the heap, see tlab_refill.
+// Returns the end of the heap, past the last pinned cell.
+static Cell *clear_holes(VM *vm, Cell *end, Cell **pins, size_t pinned) {
+    vm->holes = realloc(vm->holes, pinned * sizeof(Hole));
+    for (size_t i = 0; i < pinned; i++) {
+        if (pins[i] < end)
+            continue;
+        if (pins[i] > end) {
+            memset(end, 0, (pins[i] - end) * sizeof(Cell));
+            vm->holes[vm->holesSize++] = (Hole){end, pins[i]};
+            vm->holeCells += pins[i] - end;
+        }
+        end = pins[i] + 1;
+    }
+    return end;
+}
+
+// Free memory for the unused objects from young on, the pinned ones are
+// kept in place.
+static void collect(VM* vm, Cell* young, Cell **pins, size_t pinned) {
+    stats_gc_begin(vm);
+    heap_seal(vm);
+    // they are compacted over like any free cell, those before young are
+    // kept
+    if (young == vm->heap) {
+        vm->holesSize = vm->holesNext = 0;
+        vm->holeCells = 0;
+    }
+
     // Find out which objects are still in use.
+    markBefore(vm, young);
     markAll(vm);
+    for (size_t i = 0; i < pinned; i++) {
+        mark(vm, pins[i]);
+    }
 
     // Determine where they will end up.
-    void* end = calculateNewLocations(vm);
+    Cell *end = calculateNewLocations(vm, pins, pinned);
 
     // Fix the references to them.
     updateAllObjectPointers(vm);
 
     // Compact the memory.
     compact(vm);
+    if (pinned > 0)
+        end = clear_holes(vm, end, pins, pinned);
 
     // Update the end of the heap to the new post-compaction end.
     vm->next = end;
+    vm->numObjs = vm->next - vm->heap;
 
-    printf("%ld live bytes after collection.\n", vm->next - vm->heap);
+    // call sites and callees have moved
+    vm->bindingsVersion++;
+
+    stats_gc_end(vm);
+    debuglog("%ld live bytes after collection.\n",
+             (vm->next - vm->heap) * sizeof(Cell));
 }
 
+// Let the heap grow with the live set so we don't collect on every form.
+// The holes are filled first.
+static void gc_threshold(VM *vm) {
+    long live = vm->next - vm->heap - vm->holeCells;
+    vm->gcThreshold = vm->next + HEAP_SIZE + live;
+    if (vm->gcThreshold > vm->heap + HEAP_LIMIT)
+        vm->gcThreshold = vm->heap + HEAP_LIMIT;
+}
 
-Cell* newObject(VM* vm) {
-    if ((vm->next + 1) > (vm->heap + HEAP_SIZE)) {
-        gc(vm);
+// the end of the calling thread's stack, which grows down
+static void **stack_base(void) {
+    static _Thread_local void **base = NULL;
+    if (base == NULL) {
+        pthread_attr_t attr;
+        void *addr;
+        size_t size;
+        pthread_getattr_np(pthread_self(), &attr);
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        base = (void**)((char*)addr + size);
+    }
+    return base;
+}
+
+__attribute__((noinline))
+void mutator_park(Mutator *m) {
+    m->stackBase = stack_base();
+    m->parkedAt = __builtin_frame_address(0);
+}
+
+static int compare_cells(const void *x, const void *y) {
+    Cell *a = *(Cell**)x, *b = *(Cell**)y;
+    return a < b ? -1 : a > b;
+}
 
-        // If there still isn't room after collection, we can't fit it.
-        if ((vm->next + 1) > (vm->heap + HEAP_SIZE)) {
-            perror("Out of memory");
-            exit(1);
+typedef struct {
+    Cell **cells;
+    size_t size;
+    size_t capacity;
+} Pins;
+
+// the cells the words from p up to end point in
+__attribute__((no_sanitize_address))
+static void pins_add(VM *vm, Pins *pins, void **p, void **end) {
+    for (; p < end; p++) {
+        if (!in_heap(vm, *p))
+            continue;
+        if (pins->size == pins->capacity) {
+            pins->capacity = pins->capacity ? 2 * pins->capacity : 256;
+            pins->cells = realloc(pins->cells, pins->capacity * sizeof(Cell*));
         }
+        pins->cells[pins->size++] =
+            vm->heap + ((char*)*p - (char*)vm->heap) / sizeof(Cell);
     }
+}
+
+// The cells the parked workers' stacks point in, and the calling thread's
+// from the caller's frame up if own, in address order and each once. The
+// caller has spilled the registers.
+__attribute__((noinline))
+static Cell **stack_pins(VM *vm, bool own, size_t *pinned) {
+    Pins pins = {0};
+    if (own)
+        pins_add(vm, &pins, __builtin_frame_address(0), stack_base());
+    Mutator *m;
+    for (int k = 1; (m = mutator_at(vm, k)) != NULL; k++) {
+        if (m->parkedAt != NULL)
+            pins_add(vm, &pins, m->parkedAt, m->stackBase);
+    }
+    if (pins.size > 0)
+        qsort(pins.cells, pins.size, sizeof(Cell*), compare_cells);
+    size_t unique = 0;
+    for (size_t i = 0; i < pins.size; i++) {
+        if (unique == 0 || pins.cells[unique - 1] != pins.cells[i])
+            pins.cells[unique++] = pins.cells[i];
+    }
+    *pinned = unique;
+    return pins.cells;
+}
+
+// Free memory for all unused objects. The cells the C stacks of the parked
+// workers point in stay in place, see gc_eval.
+void gc(VM* vm) {
+    size_t pinned;
+    Cell **pins = stack_pins(vm, false, &pinned);
+    collect(vm, vm->heap, pins, pinned);
+    free(pins);
+}
+
+// Collection moves objects, so it may only run where every live object is
+// reachable from the roots: between top level forms. In between, see
+// gc_eval. Workers are parked while it runs, see pool_stop.
+void gc_safepoint(VM* vm) {
+    if (__atomic_load_n(&vm->next, __ATOMIC_RELAXED) < vm->gcThreshold) return;
+
+    pool_stop(vm);
+    gc(vm);
+    pool_resume(vm);
+    gc_threshold(vm);
+}
+
+// The C frames of the threads hold cells nothing else refers to, and
+// nothing tells which of their words are cells. Every word of the stacks
+// that points into the heap is taken for one: the cell it points in is
+// kept, in place, and the others are compacted around the pinned ones.
+// Only the VM's own thread collects so, the workers running futures are
+// parked, see pool_park.
+void gc_eval(VM *vm) {
+    // callee saved registers go to this frame, for stack_pins to find
+    __builtin_unwind_init();
+    pool_stop(vm);
+    size_t pinned;
+    Cell **pins = stack_pins(vm, true, &pinned);
+    collect(vm, vm->heap, pins, pinned);
+    vm->evalCollections++;
+    pool_resume(vm);
+    free(pins);
+    gc_threshold(vm);
+    if (vm->next >= vm->heap + HEAP_LIMIT)
+        raise_error("out of memory, %ld cells in use",
+                    (long)(vm->next - vm->heap - vm->holeCells));
+}
+
+// the words of the stack stack_clear clears
+#define STACK_CLEAR_WORDS 4096
+
+__attribute__((noinline))
+void stack_clear(void) {
+    void *words[STACK_CLEAR_WORDS];
+    memset(words, 0, sizeof(words));
+    // the stores are kept though nothing reads them
+    __asm__ volatile("" : : "r"(words) : "memory");
+}
+
+// The thread gives up its TLAB and the holes, the cells it makes next are
+// past vm->next.
+long gc_young_start(VM *vm) {
+    mutator_seal(getMutator());
+    vm->holesNext = vm->holesSize;
+    return __atomic_load_n(&vm->next, __ATOMIC_RELAXED) - vm->heap;
+}
+
+// A collection in the middle of an evaluation, where the C frames of the
+// VM's own thread only hold cells from before young, besides those on its
+// stack, and no future is running. The cells before young do not move.
+void gc_young(VM* vm, long young) {
+    pool_stop(vm);
+    collect(vm, vm->heap + young, NULL, 0);
+    pool_resume(vm);
+}
+
+// Zeroed cells are unmarked and of no type, every heap walk skips them.
+void mutator_seal(Mutator *m) {
+    if (m->tlab < m->tlabEnd)
+        memset(m->tlab, 0, (m->tlabEnd - m->tlab) * sizeof(Cell));
+    m->tlab = m->tlabEnd = NULL;
+}
 
-    vm->numObjs++;
-    vm->next += 1;
+void heap_seal(VM *vm) {
+    mutator_seal(&vm->main);
+    pool_seal(vm);
+}
+
+// The holes a collection left are only the VM's own thread's, taken
+// before the end of the heap. What is taken from them brings the next
+// collection closer like what is taken from the end.
+static Cell *hole_take(VM *vm, Mutator *m, Cell **end) {
+    if (m != &vm->main || vm->holesNext == vm->holesSize)
+        return NULL;
+    Hole *hole = &vm->holes[vm->holesNext];
+    Cell *chunk = hole->start;
+    *end = hole->end - chunk > TLAB_SIZE ? chunk + TLAB_SIZE : hole->end;
+    hole->start = *end;
+    if (hole->start == hole->end)
+        vm->holesNext++;
+    vm->gcThreshold -= *end - chunk;
+    return chunk;
+}
+
+// Workers stop here while a collection runs, and wake the VM's thread up
+// when one is due, it may be waiting for them in touch. They hold no lock
+// when they allocate.
+static void tlab_refill(VM *vm, Mutator *m) {
+    if (m != &vm->main) {
+        gc_poll(vm, m);
+        if (gc_due(vm))
+            pool_wake(vm);
+    }
+    m->refills++;
+    Cell *end;
+    Cell *chunk = hole_take(vm, m, &end);
+    if (chunk != NULL) {
+        m->tlab = chunk;
+        m->tlabEnd = end;
+        return;
+    }
+    chunk = __atomic_fetch_add(&vm->next, TLAB_SIZE * sizeof(Cell),
+                               __ATOMIC_RELAXED);
+    // Evaluation raises past HEAP_LIMIT, see gc_eval. What gets here is a
+    // primitive allocating the rest of the reservation by itself, or
+    // futures while the VM's thread does not get to collect.
+    if (chunk + TLAB_SIZE > vm->heap + HEAP_MAX) {
+        perror("Out of memory");
+        exit(1);
+    }
+    m->tlab = chunk;
+    m->tlabEnd = chunk + TLAB_SIZE;
+    unsigned long tlabs = __atomic_add_fetch(&vm->tlabs, 1, __ATOMIC_RELAXED);
+    if (vm->tlabLimit != 0 && tlabs >= vm->tlabLimit)
+        __atomic_store_n(&vm->interrupt, INTERRUPT_MEMORY, __ATOMIC_RELAXED);
+}
 
-    Cell* object = (Cell*)vm->next;
-    return object;
+Cell* newObject(VM* vm) {
+    Mutator *m = getMutator();
+    if (m->tlab == m->tlabEnd)
+        tlab_refill(vm, m);
+    return m->tlab++;
 }
 
 //
 
-Cell *make_cell(LispType type, void *data) {
-    Cell *_cell = newObject(getVM());
+// caller is the C code allocating, sampled for allocation sites
+static Cell *new_cell(LispType type, void *data, void *caller) {
+    VM *vm = getVM();
+    Cell *_cell = newObject(vm);
+    stats_alloc(getMutator(), type, caller);
     debuglog("type=%d, %p\n", type, data);
     /* print_expr(_cell); */
     /* Cell *_cell = calloc(1, sizeof(Cell)); */
     _cell->type = type;
+    _cell->moveTo = NULL;
     _cell->val = data;
     _cell->next = NULL;
     return _cell;
 }
 
-Cell *cons(Cell *x, Cell *y) {
-    Cell *_pair = make_cell(TypePair, x);
-    _pair->next = y;
-    return _pair;
+Cell *make_cell(LispType type, void *data) {
+    return new_cell(type, data, __builtin_return_address(0));
 }
 
-int count_obj(Cell* cell) {
-    if (null(cell)) {
-        return 0;
-    }
-    // check procedure before list
-    // procedure has cylic reference to env, this is a black hole (segment fault)
-    else if (is_atom(cell) || is_primitive(cell) || is_procedure(cell)) {
-        return 1;
-    }
-    else if (is_pair(cell)) {
-        return 1 + count_obj(car(cell)) + count_obj(cdr(cell));
-    }
-    else {
-        printf("<%s: unsupported exp type=%d>", __func__, cell->type);
-    }
-    return 1;
+Cell *make_int(int n) {
+    if (n >= SMALL_INT_MIN && n <= SMALL_INT_MAX)
+        return &small_ints[n - SMALL_INT_MIN];
+    return new_cell(TypeInt, (void*)(intptr_t)n, __builtin_return_address(0));
 }
 
+Cell *cons(Cell *x, Cell *y) {
+    Cell *_pair = new_cell(TypePair, x, __builtin_return_address(0));
+    _pair->next = y;
+    return _pair;
+}
 
-int count_freeable_obj(Cell* cell) {
-    if (null(cell) || is_symbol(cell)) {
-        return 0;
-    }
-    else if (is_atom(cell)) {
-        return 1;
-    }
-    // check procedure before list
-    else if (is_pair(cell)) {
-        return 1 + count_obj(car(cell)) + count_obj(cdr(cell));
-    }
-    else {
-        printf("<%s: unsupported exp type=%d>", __func__, cell->type);
-    }
-    return 0;
+// A pair that lives until the region is released past it, or a heap pair
+// once the region is full.
+Cell *region_cons(Mutator *m, Cell *x, Cell *y) {
+    if (m->regionNext == m->region + REGION_SIZE)
+        return cons(x, y);
+    Cell *_pair = m->regionNext++;
+    *_pair = (Cell){.type = TypePair, .val = x, .next = y};
+    return _pair;
 }
 
 //
 
-void *intern(char *sym) {
-    if (sym == NULL) return symbols;
+static const char *form_names[FormCount] = {
+    NULL, "quote", "if", "set!", "define", "define-macro", "lambda", "begin",
+    "quasiquote", "unquote", "unquote-splicing", "%inlined", "catch",
+    "unwind-protect", "future", "delay", "cons-stream", "stream-fold",
+};
 
-    /* debuglog("interning symbol %s\n", sym); */
-    dolist_cdr(_pair, symbols) {
+// the symbol named sym in symbols before end, or NULL
+static Cell *find_symbol(Cell *symbols, Cell *end, char *sym) {
+    for (Cell *_pair = symbols; _pair != end; _pair = cdr(_pair)) {
         /* debuglog("interning symbol, %p, %p|\n", car(_pair), cdr(_pair)); */
         if (car(_pair)
             && strncmp(sym, (char*)((Cell*)car(_pair))->val, 32) == 0)
             return car(_pair);
     }
+    return NULL;
+}
+
+// The table only ever grows at its head, so it is searched without the
+// lock; adding takes it and searches what was added in the meantime.
+void *intern(char *sym) {
+    VM *vm = getVM();
+    if (sym == NULL) return vm->symbols;
+    if (string_eq(sym, "nil")) return nil();
+
+    /* debuglog("interning symbol %s\n", sym); */
+    Cell *symbols = __atomic_load_n(&vm->symbols, __ATOMIC_ACQUIRE);
+    Cell *found = find_symbol(symbols, nil(), sym);
+    if (found)
+        return found;
+
+    // made before taking the lock, a worker may stop where it allocates,
+    // see pool_park
+    Cell *symbol = make_cell(TypeSymbol, strdup(sym));
+    for (int form = FormNone + 1; form < FormCount; form++) {
+        if (string_eq(sym, form_names[form]))
+            symbol->flags = form;
+    }
+    Cell *entry = cons(symbol, nil());
+    pthread_mutex_lock(&vm->lock);
+    found = find_symbol(vm->symbols, symbols, sym);
+    if (found == NULL) {
+        found = symbol;
+        debuglog("creating new symbol %s\n", sym);
+        entry->next = vm->symbols;
+        __atomic_store_n(&vm->symbols, entry, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&vm->lock);
+    if (found != symbol) {
+        free(symbol->val);
+        symbol->val = NULL;
+    }
+    return found;
+}
 
-    Cell *newSym = make_cell(TypeSymbol, strdup(sym));
-    debuglog("creating new symbol %s\n", sym);
-    symbols = cons(newSym, symbols);
-    return car(symbols);
+char *type_name(LispType type) {
+    static char *names[TypeCount] = {
+        "unknown", "int", "float", "ratio", "fixnum", "string", "symbol",
+        "pair", "primitive", "error", "procedure", "future", "builder",
+        "promise", "port",
+    };
+    return type < TypeCount ? names[type] : "unknown";
 }
 
 bool equal(Cell *x, Cell *y) {
@@ -267,6 +709,7 @@ bool equal(Cell *x, Cell *y) {
     if (x->type == y->type) {
         switch(x->type) {
         case TypeString:
+            return string_equal(x, y);
         case TypeSymbol:
             return string_eq(x->val, y->val);
         case TypePair:
@@ -276,7 +719,7 @@ bool equal(Cell *x, Cell *y) {
                              cdr(y)));
         case TypeInt:
         case TypeFixNum:
-            return *((int*)x->val) == *((int *)y->val);
+            return int_val(x) == int_val(y);
         case TypeFloat:
             return *((float*)x->val) == *((float *)y->val);
         case TypeRatio:
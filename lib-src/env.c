@@ -2,59 +2,473 @@
 #include "env.h"
 #include "reader.h"
 #include "data.h"
+#include "image.h"
+#include "lisp.h"
+#include "extension.h"
+#include "stats.h"
+#include "profile.h"
+#include "census.h"
+#include "condition.h"
+#include "compile.h"
+#include "pool.h"
+#include "text.h"
+#include "stream.h"
 
-#define env_addPrim(name, def, env) ({                                  \
-            static Cell prim_name = {.type=TypeSymbol, .val=(name)};    \
-            static Cell prim_def = {.type=TypePrim, .val=(def),         \
-                                    .next=(void*)name};                 \
-            env_add_var_def(&prim_name, &prim_def, env);                \
+// prim cells live in the heap like everything else, so images can save them
+#define env_addPrim(def, env) ({                                        \
+            Cell *prim = make_cell(TypePrim, (void*)(def));             \
+            env_add_var_def(intern((def)->name), prim, env);            \
         })
 
-Cell *prim_list(Cell *args) { return args; }
-Cell *prim_eq(Cell *args) {
-    return to_lisp_bool((Cell*)car(args) == (Cell*)cadr(args));
+Cell *prim_list(int argc, Cell **argv) {
+    Cell *list = nil();
+    while (argc > 0) {
+        list = cons(argv[--argc], list);
+    }
+    return list;
+}
+Cell *prim_eq(int argc, Cell **argv) {
+    return to_lisp_bool(argv[0] == argv[1]);
+}
+Cell *prim_cons(int argc, Cell **argv) { return cons(argv[0], argv[1]); }
+// (car nil) and (cdr nil) are nil
+Cell *prim_car(int argc, Cell **argv) {
+    if (null(argv[0])) return nil();
+    ensure(argv[0], TypePair);
+    return car(argv[0]);
+}
+Cell *prim_cdr(int argc, Cell **argv) {
+    if (null(argv[0])) return nil();
+    ensure(argv[0], TypePair);
+    return cdr(argv[0]);
+}
+Cell *prim_atomp(int argc, Cell **argv) {
+    return to_lisp_bool(is_atom(argv[0]));
+}
+
+// integer arithmetic, folding over the arguments
+#define def_prim_arith(fname, op, init)                                 \
+    Cell *fname(int argc, Cell **argv) {                                \
+        int acc = init;                                                 \
+        for (int i = 0; i < argc; i++) {                                \
+            ensure(argv[i], TypeInt);                                   \
+            acc = acc op int_val(argv[i]);                              \
+        }                                                               \
+        return make_int(acc);                                           \
+    }
+
+def_prim_arith(prim_add, +, 0)
+def_prim_arith(prim_mul, *, 1)
+
+// (- x) negates, (- x y ...) subtracts the rest from x
+Cell *prim_sub(int argc, Cell **argv) {
+    ensure(argv[0], TypeInt);
+    if (argc == 1)
+        return make_int(-int_val(argv[0]));
+    int acc = int_val(argv[0]);
+    for (int i = 1; i < argc; i++) {
+        ensure(argv[i], TypeInt);
+        acc -= int_val(argv[i]);
+    }
+    return make_int(acc);
+}
+
+#define def_prim_compare(fname, op)                                     \
+    Cell *fname(int argc, Cell **argv) {                                \
+        ensure(argv[0], TypeInt);                                       \
+        ensure(argv[1], TypeInt);                                       \
+        return to_lisp_bool(int_val(argv[0]) op int_val(argv[1]));     \
+    }
+
+def_prim_compare(prim_num_eq, ==)
+def_prim_compare(prim_less, <)
+
+Cell *prim_exit(int argc, Cell **argv) {
+    if (argc == 0)
+        exit(0);
+    ensure(argv[0], TypeInt);
+    exit(int_val(argv[0]));
+}
+
+Cell *prim_print(int argc, Cell **argv) {
+    print_expr(argv[0]);
+    printf("\n");
+    return argv[0];
+}
+
+Cell *prim_load(int argc, Cell **argv) {
+    Cell *path = argv[0];
+    ensure(path, TypeString);
+    string_local(name, path);
+    FILE *input = fopen(name, "r");
+    if (input == NULL)
+        raise_error("cannot open %s", name);
+    VM *vm = getVM();
+    Mutator *m = getMutator();
+    // (optimize t) in the file only holds for the rest of it
+    bool optimize = vm->optimize;
+    Handler handler;
+    if (handler_enter(m, &handler) != 0) {
+        vm->optimize = optimize;
+        fclose(input);
+        lisp_raise(handler.condition);
+    }
+    Cell *result = load(input, vm->globals);
+    handler_leave(m, &handler);
+    vm->optimize = optimize;
+    fclose(input);
+    return result;
+}
+
+// (error "message") raises an error with the message, any other argument
+// is printed into it
+Cell *prim_error(int argc, Cell **argv) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    fprintf(out, "ERROR: ");
+    if (is_string(argv[0]))
+        fwrite(string_bytes(argv[0]), 1, string_size(argv[0]), out);
+    else
+        fprint_expr(out, argv[0]);
+    fclose(out);
+    Cell *condition = make_error(text);
+    free(text);
+    lisp_raise(condition);
+}
+
+Cell *prim_errorp(int argc, Cell **argv) {
+    return to_lisp_bool(is_error(argv[0]));
+}
+
+// what walks the heap or changes the process waits for the futures
+#define ensure_serial(name) ({                                          \
+            if (vm_parallel(getVM()))                                   \
+                raise_error("%s while futures are running", name);      \
+        })
+
+Cell *prim_save_image(int argc, Cell **argv) {
+    Cell *path = argv[0];
+    ensure(path, TypeString);
+    ensure_serial("save-image");
+    string_local(name, path);
+    if (!save_image(name))
+        raise_error("cannot save image to %s", name);
+    return lisp_true;
+}
+
+Cell *prim_load_extension(int argc, Cell **argv) {
+    Cell *path = argv[0];
+    ensure(path, TypeString);
+    ensure_serial("load-extension");
+    string_local(name, path);
+    char *err = load_extension(name);
+    if (err != NULL)
+        raise_error("cannot load %s, %s", name, err);
+    return lisp_true;
+}
+
+// (compile-file "x.lisp") builds x.so next to it, or out when given, and
+// loads it, see compile.h
+Cell *prim_compile_file(int argc, Cell **argv) {
+    Cell *src = argv[0];
+    ensure(src, TypeString);
+    ensure_serial("compile-file");
+    string_local(path, src);
+    if (argc == 2) {
+        ensure(argv[1], TypeString);
+        string_local(out, argv[1]);
+        return compile_file(path, out);
+    }
+    size_t n = strlen(path);
+    char out[n + 4];
+    strcpy(out, path);
+    if (n > 5 && string_eq(out + n - 5, ".lisp"))
+        out[n - 5] = '\0';
+    strcat(out, ".so");
+    return compile_file(path, out);
 }
-Cell *prim_cons(Cell *args) { return cons(car(args), cadr(args)); }
-Cell *prim_car(Cell *args) { return car((Cell*)car(args)); }
-Cell *prim_cdr(Cell *args) { return cdr((Cell*)car(args)); }
-Cell *prim_atomp(Cell *args) { return to_lisp_bool(is_atom((Cell*)car(args))); }
 
-Cell *prim_exit(Cell *args) { exit(1); }
+Cell *prim_runtime_stats(int argc, Cell **argv) {
+    return stats_to_list(getVM());
+}
+
+// (trace t) prints every eval, apply and allocation on stderr
+Cell *prim_trace(int argc, Cell **argv) {
+    getVM()->trace = !null(argv[0]);
+    return argv[0];
+}
+
+// (optimize t) optimizes the procedures made from then on, see optimize.h
+Cell *prim_optimize(int argc, Cell **argv) {
+    getVM()->optimize = !null(argv[0]);
+    return argv[0];
+}
+
+Cell *prim_profile_start(int argc, Cell **argv) {
+    if (!profile_start(getVM()))
+        raise_error("already profiling%s", "");
+    return lisp_true;
+}
+
+// writes folded stacks to path
+Cell *prim_profile_stop(int argc, Cell **argv) {
+    Cell *path = argv[0];
+    ensure(path, TypeString);
+    string_local(name, path);
+    if (!profile_stop(getVM(), name))
+        raise_error("cannot write profile to %s", name);
+    return lisp_true;
+}
+
+// live cells by type, allocation sites and the largest retained roots
+Cell *prim_heap_census(int argc, Cell **argv) {
+    ensure_serial("heap-census");
+    return census_to_list(getVM());
+}
+
+Cell *prim_touch(int argc, Cell **argv) {
+    return touch(argv[0]);
+}
+
+// (pmap f list) is (map f list) with each call a future
+Cell *prim_pmap(int argc, Cell **argv) {
+    return pmap(argv[0], argv[1]);
+}
+
+// strings, see text.h
+Cell *prim_string_length(int argc, Cell **argv) {
+    ensure(argv[0], TypeString);
+    return make_int(string_length(argv[0]));
+}
+
+// (substring s start [end]) shares the bytes of s
+Cell *prim_substring(int argc, Cell **argv) {
+    ensure(argv[0], TypeString);
+    ensure(argv[1], TypeInt);
+    long end = string_length(argv[0]);
+    if (argc == 3) {
+        ensure(argv[2], TypeInt);
+        end = int_val(argv[2]);
+    }
+    return substring(argv[0], int_val(argv[1]), end);
+}
+
+Cell *prim_string_append(int argc, Cell **argv) {
+    return string_append(argc, argv);
+}
+
+Cell *prim_string_eq(int argc, Cell **argv) {
+    ensure(argv[0], TypeString);
+    ensure(argv[1], TypeString);
+    return to_lisp_bool(string_equal(argv[0], argv[1]));
+}
+
+// (string-search pattern s [start])
+Cell *prim_string_search(int argc, Cell **argv) {
+    ensure(argv[0], TypeString);
+    ensure(argv[1], TypeString);
+    long start = 0;
+    if (argc == 3) {
+        ensure(argv[2], TypeInt);
+        start = int_val(argv[2]);
+    }
+    return string_search(argv[1], argv[0], start);
+}
+
+// (string-split s separator)
+Cell *prim_string_split(int argc, Cell **argv) {
+    ensure(argv[0], TypeString);
+    ensure(argv[1], TypeString);
+    return string_split(argv[0], argv[1]);
+}
+
+Cell *prim_make_string_builder(int argc, Cell **argv) {
+    return make_builder();
+}
+
+Cell *prim_string_builder_add(int argc, Cell **argv) {
+    return builder_add(argv[0], argv[1]);
+}
+
+Cell *prim_string_builder_result(int argc, Cell **argv) {
+    return builder_string(argv[0]);
+}
+
+// promises and streams, see stream.h
+Cell *prim_force(int argc, Cell **argv) {
+    return force(argv[0]);
+}
+
+Cell *prim_stream_car(int argc, Cell **argv) {
+    Cell *s = force(argv[0]);
+    ensure(s, TypePair);
+    return car(s);
+}
+
+Cell *prim_stream_cdr(int argc, Cell **argv) {
+    Cell *s = force(argv[0]);
+    ensure(s, TypePair);
+    return force(cdr(s));
+}
+
+Cell *prim_stream_map(int argc, Cell **argv) {
+    return stream_map(argv[0], argv[1]);
+}
+
+Cell *prim_stream_filter(int argc, Cell **argv) {
+    return stream_filter(argv[0], argv[1]);
+}
+
+Cell *prim_stream_take(int argc, Cell **argv) {
+    ensure(argv[0], TypeInt);
+    return stream_take(int_val(argv[0]), argv[1]);
+}
+
+Cell *prim_open_input_file(int argc, Cell **argv) {
+    Cell *path = argv[0];
+    ensure(path, TypeString);
+    string_local(name, path);
+    return open_port(name);
+}
+
+// (port-stream port ['lines]), forms unless 'lines
+Cell *prim_port_stream(int argc, Cell **argv) {
+    bool lines = argc == 2 && argv[1] == intern("lines");
+    if (argc == 2 && !lines && argv[1] != intern("forms"))
+        raise_error("port-stream reads forms or lines%s", "");
+    return port_stream(argv[0], lines);
+}
+
+Cell *prim_close_port(int argc, Cell **argv) {
+    close_port(argv[0]);
+    return lisp_true;
+}
+
+// Primitives are bound by name, an image refers to them the same way.
+static const PrimDef prims[] = {
+    {"list", prim_list, 0, ARGS_MANY},
+    {"eq", prim_eq, 2, 2},
+    {"cons", prim_cons, 2, 2},
+    {"car", prim_car, 1, 1},
+    {"cdr", prim_cdr, 1, 1},
+    {"atom?", prim_atomp, 1, 1},
+    {"+", prim_add, 0, ARGS_MANY},
+    {"-", prim_sub, 1, ARGS_MANY},
+    {"*", prim_mul, 0, ARGS_MANY},
+    {"=", prim_num_eq, 2, 2},
+    {"<", prim_less, 2, 2},
+    {"exit", prim_exit, 0, 1},
+    {"print", prim_print, 1, 1},
+    {"load", prim_load, 1, 1},
+    {"error", prim_error, 1, 1},
+    {"error?", prim_errorp, 1, 1},
+    {"save-image", prim_save_image, 1, 1},
+    {"load-extension", prim_load_extension, 1, 1},
+    {"compile-file", prim_compile_file, 1, 2},
+    {"runtime-stats", prim_runtime_stats, 0, 0},
+    {"trace", prim_trace, 1, 1},
+    {"optimize", prim_optimize, 1, 1},
+    {"profile-start", prim_profile_start, 0, 0},
+    {"profile-stop", prim_profile_stop, 1, 1},
+    {"heap-census", prim_heap_census, 0, 0},
+    {"touch", prim_touch, 1, 1},
+    {"pmap", prim_pmap, 2, 2},
+    {"string-length", prim_string_length, 1, 1},
+    {"substring", prim_substring, 2, 3},
+    {"string-append", prim_string_append, 0, ARGS_MANY},
+    {"string=?", prim_string_eq, 2, 2},
+    {"string-search", prim_string_search, 2, 3},
+    {"string-split", prim_string_split, 2, 2},
+    {"make-string-builder", prim_make_string_builder, 0, 0},
+    {"string-builder-add!", prim_string_builder_add, 2, 2},
+    {"string-builder-result", prim_string_builder_result, 1, 1},
+    {"force", prim_force, 1, 1},
+    {"stream-car", prim_stream_car, 1, 1},
+    {"stream-cdr", prim_stream_cdr, 1, 1},
+    {"stream-map", prim_stream_map, 2, 2},
+    {"stream-filter", prim_stream_filter, 2, 2},
+    {"stream-take", prim_stream_take, 2, 2},
+    {"open-input-file", prim_open_input_file, 1, 1},
+    {"port-stream", prim_port_stream, 1, 2},
+    {"close-port", prim_close_port, 1, 1},
+};
+
+#define PRIMS_COUNT (sizeof(prims) / sizeof(prims[0]))
+
+const PrimDef *lookup_prim(char *name) {
+    for (size_t i = 0; i < PRIMS_COUNT; i++) {
+        if (string_eq(prims[i].name, name))
+            return &prims[i];
+    }
+    return lookup_extension_prim(getVM(), name);
+}
 
 Environment *init_environment() {
     Environment *env = cons(nil(), nil());
-    env_addPrim("list", (void*)prim_list, env);
-    env_addPrim("eq", (void*)prim_eq, env);
-    env_addPrim("cons", (void*)prim_cons, env);
-    env_addPrim("car", (void*)prim_car, env);
-    env_addPrim("cdr", (void*)prim_cdr, env);
-    env_addPrim("atom?", (void*)prim_atomp, env);
-    env_addPrim("exit", (void*)prim_exit, env);
+    getVM()->globals = env;
+    env_add_var_def(lisp_true, lisp_true, env);
+    for (size_t i = 0; i < PRIMS_COUNT; i++) {
+        env_addPrim(&prims[i], env);
+    }
     return env;
 }
 
+// Global definitions are made under the VM lock, workers running futures
+// may define at the same time, and so are the others while futures run:
+// a frame a future closed over is shared with it. Lookups need no lock,
+// the frame only grows at its head. The binding is made before taking the
+// lock, a worker may stop where it allocates, see pool_park.
 Cell *env_add_var_def(Cell *var, Cell *val, Environment *env) {
     ensure(var, TypeSymbol);
     ensure(env, TypePair);
+    VM *vm = getVM();
+    bool global = null(cdr(env));
+    bool locked = global || vm_parallel(vm);
+    Cell *binding = cons(cons(var, val), nil());
+    if (locked)
+        pthread_mutex_lock(&vm->lock);
     Cell *frame = (Cell*)car(env);
-    /* print_expr(env); */
-    // check if at root frame
-    if (null(cdr(env))) {
-        /* debuglog("top level def %p\n", env); */
-        /* set_car(env, _cons(_cons(var, val), frame)); */
+    // a global is redefined in place, code the optimizer inlined it into
+    // checks the binding
+    Cell *pair = global ? assoc(var, frame) : nil();
+    if (!null(pair)) {
+        __atomic_store_n(&pair->next, val, __ATOMIC_SEQ_CST);
     } else {
-        /* debuglog("nested def %p\n", env); */
+        binding->next = frame;
+        __atomic_store_n(&env->val, binding, __ATOMIC_RELEASE);
     }
-    set_car(env, cons(cons(var, val), frame));
+    // a new binding may shadow one a call site has cached
+    __atomic_add_fetch(&vm->bindingsVersion, 1, __ATOMIC_RELEASE);
+    if (locked)
+        pthread_mutex_unlock(&vm->lock);
     return val;
 }
 
+// frames get new bindings in front while other threads look them up, see
+// env_add_var_def
+#define frame_bindings(frame) \
+    ((Cell*)__atomic_load_n(&(frame)->val, __ATOMIC_ACQUIRE))
+
+// The (var . val) pair binding var, or nil. *scope is set to the env
+// whose first frame has it, so null(cdr(*scope)) tells a global binding.
+Cell *env_lookup_binding(Cell *var, Environment *env, Environment **scope) {
+    dolist_cdr(frame, env) {
+        Cell *pair = assoc(var, frame_bindings(frame));
+        if (!null(pair)) {
+            *scope = frame;
+            return pair;
+        }
+    }
+    return nil();
+}
+
 Cell *env_lookup_var(Cell *var, Environment *env) {
     ensure(var, TypeSymbol);
     ensure(env, TypePair);
     /* debuglog("length of env, %p\n", env->type); */
     dolist_cdr(frame, env) {
-        Cell *pair = assoc(var, car(frame));
+        Cell *pair = assoc(var, frame_bindings(frame));
         if (!null(pair)) {
             /* debuglog("variable found, %s\n", (char*)var->val); */
             Cell *def = cdr(pair);
@@ -64,29 +478,74 @@ Cell *env_lookup_var(Cell *var, Environment *env) {
             return def;
         }
     }
-    return_error("variable not defined, %s\n", (char*)var->val);
+    raise_error("variable not defined, %s\n", (char*)var->val);
 }
 
 Cell *env_set_variable_value(Cell *var, Cell *val, Environment *env) {
     ensure(var, TypeSymbol);
     ensure(env, TypePair);
     dolist_cdr(frame, env) {
-        Cell *pair = assoc(var, car(frame));
+        Cell *pair = assoc(var, frame_bindings(frame));
         if (!null(pair)) {
-            set_cdr(pair, val);
+            // see lookup_callee
+            __atomic_store_n(&pair->next, val, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&pair->flags, __ATOMIC_SEQ_CST)
+                & CELL_CACHED_BINDING)
+                __atomic_add_fetch(&getVM()->bindingsVersion, 1,
+                                   __ATOMIC_RELEASE);
             return val;
         }
     }
     return nil();
 }
 
-Environment *env_extend_stack(Cell *arg_syms, Cell *args, Environment *env) {
-    ensure(arg_syms, TypePair);
-    ensure(args, TypePair);
+// argv holds a value for each of arg_syms, and when they are a dotted
+// list the symbol ending it is bound to a list of the rest. Call sites
+// only cache global bindings, so parameters can shadow without
+// invalidating them.
+Environment *env_extend_stack(Cell *arg_syms, int argc, Cell **argv,
+                              Environment *env) {
     ensure(env, TypePair);
-    env = cons(nil(), env);
-    for (; !null(arg_syms); arg_syms = cdr(arg_syms), args = cdr(args)) {
-        env_add_var_def(car(arg_syms), car(args), env);
+    Cell *frame = nil();
+    for (; is_pair(arg_syms); arg_syms = cdr(arg_syms), argc--) {
+        frame = cons(cons(car(arg_syms), *argv++), frame);
     }
+    if (!null(arg_syms))
+        frame = cons(cons(arg_syms, prim_list(argc, argv)), frame);
+    return cons(frame, env);
+}
+
+// The same frame as env_extend_stack, built on the region stack. A rest
+// list is a value the body may return, it goes in the heap. The env is
+// flagged CELL_LOCAL_FRAME.
+Environment *env_extend_region(Mutator *m, Cell *arg_syms, int argc,
+                               Cell **argv, Environment *env) {
+    Cell *frame = nil();
+    for (; is_pair(arg_syms); arg_syms = cdr(arg_syms), argc--) {
+        frame = region_cons(m, region_cons(m, car(arg_syms), *argv++),
+                            frame);
+    }
+    if (!null(arg_syms))
+        frame = region_cons(m, region_cons(m, arg_syms,
+                                           prim_list(argc, argv)),
+                            frame);
+    // the region may be full, the flag tells such a frame from a heap one
+    env = region_cons(m, frame, env);
+    env->flags |= CELL_LOCAL_FRAME;
     return env;
 }
+
+// A heap env for code that captures the region frame env after all. The
+// bindings are copied to the heap and the region frame is made to use
+// them too, so a set! through either is seen by both.
+Environment *env_to_heap(Environment *env) {
+    Cell *frame = nil();
+    Cell **tail = &frame;
+    dolist_cdr(binding, (Cell*)car(env)) {
+        Cell *pair = car(binding);
+        *tail = cons(cons(car(pair), cdr(pair)), nil());
+        tail = &(*tail)->next;
+    }
+    set_car(env, frame);
+    return cons(frame, cdr(env));
+}
@@ -0,0 +1,96 @@
+#include <dlfcn.h>
+#include "extension.h"
+#include "env.h"
+
+void ext_define_prim(VM *vm, const PrimDef *def) {
+    if (vm->extPrimsSize == EXT_PRIMS_MAX) {
+        fprintf(stderr, "ERROR: too many extension primitives, %s\n",
+                def->name);
+        return;
+    }
+    vm->extPrims[vm->extPrimsSize++] = def;
+    // an image already has the binding, only the definition is missing
+    if (vm->bindExtPrims) {
+        Cell *prim = make_cell(TypePrim, (void*)def);
+        env_add_var_def(intern(def->name), prim, vm->globals);
+    }
+}
+
+// The roots are changed under the VM lock, compiled code running in
+// futures registers them as well.
+void ext_gc_root_array(VM *vm, Cell **refs, int count) {
+    pthread_mutex_lock(&vm->lock);
+    if (vm->rootsSize == ROOTS_MAX) {
+        perror("Too many GC roots");
+        exit(1);
+    }
+    vm->roots[vm->rootsSize] = refs;
+    vm->rootCounts[vm->rootsSize++] = count;
+    pthread_mutex_unlock(&vm->lock);
+}
+
+void ext_gc_root(VM *vm, Cell **ref) {
+    ext_gc_root_array(vm, ref, 1);
+}
+
+void ext_gc_unroot(VM *vm, Cell **ref) {
+    pthread_mutex_lock(&vm->lock);
+    for (int i = 0; i < vm->rootsSize; i++) {
+        if (vm->roots[i] == ref) {
+            vm->rootsSize--;
+            vm->roots[i] = vm->roots[vm->rootsSize];
+            vm->rootCounts[i] = vm->rootCounts[vm->rootsSize];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vm->lock);
+}
+
+char *load_extension(char *path) {
+    VM *vm = getVM();
+    for (int i = 0; i < vm->extensionsSize; i++) {
+        if (string_eq(vm->extensions[i], path))
+            return NULL;
+    }
+    if (vm->extensionsSize == EXTENSIONS_MAX)
+        return "too many extensions";
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+        return dlerror();
+
+    // ISO C has no cast from an object pointer to a function pointer
+    ExtensionInitFn init;
+    *(void **)&init = dlsym(handle, EXTENSION_INIT);
+    if (init == NULL) {
+        dlclose(handle);
+        return "no " EXTENSION_INIT " in extension";
+    }
+
+    // Record it first, an image saved later refers to the path.
+    int index = vm->extensionsSize++;
+    vm->extensions[index] = strdup(path);
+    vm->extensionHandles[index] = handle;
+    if (init(vm, EXTENSION_API_VERSION) != 0) {
+        // primitives it registered stay, they point into the object
+        return "extension refused to load";
+    }
+    return NULL;
+}
+
+const PrimDef *lookup_extension_prim(VM *vm, char *name) {
+    for (int i = vm->extPrimsSize - 1; i >= 0; i--) {
+        if (string_eq(vm->extPrims[i]->name, name))
+            return vm->extPrims[i];
+    }
+    return NULL;
+}
+
+void unload_extensions(VM *vm) {
+    for (int i = 0; i < vm->extensionsSize; i++) {
+        dlclose(vm->extensionHandles[i]);
+        free(vm->extensions[i]);
+    }
+    vm->extensionsSize = 0;
+    vm->extPrimsSize = 0;
+}
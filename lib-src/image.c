@@ -0,0 +1,273 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "image.h"
+#include "extension.h"
+#include "text.h"
+
+// File layout:
+//
+//   ImageHeader | cells ... | blob ...
+//
+// Cells are stored in heap order with the same layout as in memory, so the
+// cell section can be mapped straight over the heap. Pointer fields hold an
+// encoded reference instead of an address and are fixed up after loading.
+// Data that lives outside of the heap (symbol names, strings, floats and
+// primitive names) goes to the blob, which is mapped read only while
+// loading: the cells get copies of what they point to, strings and builders
+// being saved with their size in front. Native extensions are loaded again
+// from their paths, also in the blob, before their primitives are rebound.
+
+#define IMAGE_MAGIC "LISPIMG"
+#define IMAGE_VERSION 8
+// sections start on this boundary so they can be mapped on any page size
+#define IMAGE_ALIGN 65536
+
+// encoded references
+#define REF_NULL 0
+#define REF_NIL 1
+#define REF_CELL(i) ((i) + 2)
+// preallocated integers are outside of the heap, they are saved by value
+#define REF_INT_TAG (1ULL << 63)
+#define REF_INT(n) (REF_INT_TAG | (uint32_t)(n))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t cellSize;
+    uint64_t numCells;
+    uint64_t heapOffset;
+    uint64_t blobOffset;
+    uint64_t blobSize;
+    uint64_t symbols;
+    uint64_t globals;
+    uint64_t numExtensions;
+    // blob offset of the extension paths, one after the other
+    uint64_t extensions;
+} ImageHeader;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Blob;
+
+#define align_up(x) (((x) + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1))
+
+// Returns the blob offset of a copy of data, offset by one so that 0 can
+// stand for NULL.
+static uint64_t blob_add(Blob *blob, void *data, size_t size) {
+    if (data == NULL) return 0;
+    while (blob->size + size > blob->capacity) {
+        blob->capacity = blob->capacity ? 2 * blob->capacity : 4096;
+        blob->data = realloc(blob->data, blob->capacity);
+    }
+    uint64_t offset = blob->size;
+    memcpy(blob->data + offset, data, size);
+    blob->size += size;
+    return offset + 1;
+}
+
+#define blob_add_string(blob, str) \
+    blob_add(blob, str, (str) ? strlen(str) + 1 : 0)
+
+// the size then the bytes
+static uint64_t blob_add_bytes(Blob *blob, const char *bytes, uint64_t size) {
+    uint64_t offset = blob_add(blob, &size, sizeof(size));
+    blob_add(blob, (void*)bytes, size);
+    return offset;
+}
+
+// Live cells carry their image index + 1 in moveTo while saving.
+static uint64_t encode(VM *vm, Cell *x) {
+    if (x == NULL) return REF_NULL;
+    if (null(x)) return REF_NIL;
+    if (!in_heap(vm, x) && is_integer(x)) return REF_INT(int_val(x));
+    return (uint64_t)(uintptr_t)x->moveTo + 1;
+}
+
+static void *decode(VM *vm, uint64_t ref) {
+    if (ref == REF_NULL) return NULL;
+    if (ref == REF_NIL) return nil();
+    if (ref & REF_INT_TAG) return make_int((int32_t)(ref & ~REF_INT_TAG));
+    return vm->heap + (ref - 2);
+}
+
+static void unmark_heap(VM *vm) {
+    for (Cell *c = vm->heap; c < vm->next; c++)
+        c->moveTo = NULL;
+}
+
+// Only what is reachable from the symbol table and the global env is
+// saved. The live heap is left untouched: the image is compacted as it is
+// written, so saving is safe in the middle of an evaluation.
+bool save_image(char *path) {
+    VM *vm = getVM();
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) return false;
+
+    heap_seal(vm);
+    // The same mark as the collector, from the image roots only.
+    mark(vm, vm->symbols);
+    mark(vm, vm->globals);
+
+    uint64_t numCells = 0;
+    for (Cell *c = vm->heap; c < vm->next; c++) {
+        if (c->moveTo)
+            c->moveTo = (void*)(uintptr_t)++numCells;
+    }
+
+    ImageHeader header = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .cellSize = sizeof(Cell),
+        .numCells = numCells,
+        .heapOffset = align_up(sizeof(ImageHeader)),
+        .symbols = encode(vm, vm->symbols),
+        .globals = encode(vm, vm->globals),
+    };
+    header.blobOffset = align_up(header.heapOffset + numCells * sizeof(Cell));
+
+    Blob blob = {0};
+    header.numExtensions = vm->extensionsSize;
+    for (int i = 0; i < vm->extensionsSize; i++) {
+        uint64_t offset = blob_add_string(&blob, vm->extensions[i]);
+        if (i == 0) header.extensions = offset;
+    }
+
+    bool ok = fseek(out, header.heapOffset, SEEK_SET) == 0;
+    for (Cell *c = vm->heap; ok && c < vm->next; c++) {
+        if (!c->moveTo) continue;
+
+        Cell saved = {.type = c->type, .flags = c->flags, .moveTo = NULL};
+        uint64_t val = 0, next = 0;
+        if (has_refs(c)) {
+            val = encode(vm, c->val);
+            next = encode(vm, c->next);
+        } else if (is_string(c)) {
+            val = blob_add_bytes(&blob, string_bytes(c), string_size(c));
+        } else if (is_builder(c)) {
+            StrBuf *buf = ((Builder*)c->val)->buf;
+            val = blob_add_bytes(&blob, buf->bytes, buf->size);
+        } else if (is_symbol(c) || is_error(c)) {
+            val = blob_add_string(&blob, (char*)c->val);
+        } else if (is_float(c)) {
+            val = blob_add(&blob, c->val, sizeof(float));
+        } else if (is_port(c)) {
+            // loaded closed
+            val = 0;
+        } else if (is_primitive(c)) {
+            // rebound by name when loading
+            val = blob_add_string(&blob, prim_name(c));
+        } else {
+            val = (uint64_t)(uintptr_t)c->val;
+        }
+        saved.val = (void*)(uintptr_t)val;
+        saved.next = (Cell*)(uintptr_t)next;
+        ok = fwrite(&saved, sizeof(Cell), 1, out) == 1;
+    }
+    unmark_heap(vm);
+
+    header.blobSize = blob.size;
+    ok = ok
+        && fseek(out, header.blobOffset, SEEK_SET) == 0
+        && fwrite(blob.data, 1, blob.size, out) == blob.size
+        && fseek(out, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, out) == 1;
+    free(blob.data);
+    return fclose(out) == 0 && ok;
+}
+
+// Maps the cells copy-on-write over the (empty) heap of a fresh VM and fixes
+// up pointers in place. Returns NULL if the image cannot be used.
+Environment *load_image(char *path) {
+    VM *vm = getVM();
+    ImageHeader header;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0
+        || header.version != IMAGE_VERSION
+        || header.cellSize != sizeof(Cell)
+        || header.numCells > HEAP_MAX
+        || vm->next != vm->heap) {
+        fprintf(stderr, "ERROR: %s is not a usable image\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t heapBytes = header.numCells * sizeof(Cell);
+    char *blob = NULL;
+    if ((heapBytes
+         && mmap(vm->heap, heapBytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, header.heapOffset) == MAP_FAILED)
+        || (header.blobSize
+            && (blob = mmap(NULL, header.blobSize, PROT_READ, MAP_PRIVATE,
+                            fd, header.blobOffset)) == MAP_FAILED)) {
+        perror("Cannot map image");
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    // blob offsets are stored + 1
+    char *base = blob - 1;
+
+    vm->next = vm->heap + header.numCells;
+    vm->numObjs = header.numCells;
+    Cell *end = vm->next;
+    for (Cell *c = vm->heap; c < end; c++) {
+        uint64_t val = (uint64_t)(uintptr_t)c->val;
+        uint64_t next = (uint64_t)(uintptr_t)c->next;
+        if (has_refs(c)) {
+            c->val = decode(vm, val);
+            c->next = decode(vm, next);
+        } else if (is_string(c) || is_builder(c)) {
+            uint64_t size;
+            memcpy(&size, base + val, sizeof(size));
+            char *bytes = base + val + sizeof(size);
+            c->val = is_string(c) ? (void*)string_new(bytes, size)
+                : (void*)builder_new(bytes, size);
+        } else if (is_symbol(c) || is_error(c)) {
+            c->val = val ? strdup(base + val) : NULL;
+        } else if (is_float(c) && val) {
+            c->val = memcpy(malloc(sizeof(float)), base + val, sizeof(float));
+        }
+    }
+    vm->symbols = decode(vm, header.symbols);
+    vm->globals = decode(vm, header.globals);
+
+    // The image already binds their primitives, they only need defining.
+    char *ext = base + header.extensions;
+    vm->bindExtPrims = false;
+    for (uint64_t i = 0; i < header.numExtensions; i++) {
+        char *err = load_extension(ext);
+        if (err != NULL) {
+            fprintf(stderr, "ERROR: image needs extension %s, %s\n", ext, err);
+            munmap(blob, header.blobSize);
+            return NULL;
+        }
+        ext += strlen(ext) + 1;
+    }
+    vm->bindExtPrims = true;
+
+    for (Cell *c = vm->heap; c < end; c++) {
+        if (is_primitive(c)) {
+            char *name = base + (uintptr_t)c->val;
+            c->val = (void*)lookup_prim(name);
+            if (c->val == NULL) {
+                fprintf(stderr, "ERROR: image needs primitive %s\n", name);
+                munmap(blob, header.blobSize);
+                return NULL;
+            }
+        }
+    }
+    if (blob != NULL)
+        munmap(blob, header.blobSize);
+
+    vm->gcThreshold = vm->heap + HEAP_SIZE + 2 * header.numCells;
+    return vm->globals;
+}
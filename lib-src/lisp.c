@@ -5,179 +5,547 @@
 #include "env.h"
 #include "reader.h"
 #include "lisp.h"
+#include "image.h"
+#include "stats.h"
+#include "profile.h"
+#include "census.h"
+#include "condition.h"
+#include "optimize.h"
+#include "pool.h"
+#include "stream.h"
 
 /* #define is_symbol_eq(x, y) (x == intern(y)) */
 
-#define def_prim_symbol_test(x) bool is_## x(Cell *list) { \
-        return car(list) == intern(#x);                    \
+#define def_prim_symbol_test(x, form) bool is_## x(Cell *list) { \
+        return symbol_form((Cell*)car(list)) == form;            \
     }
-#define def_prim_symbol_test_manual(x, y) bool is_ ## x(Cell *list) { return car(list) == intern(y); }
 
 bool is_self_evaluating(Cell *x) {
-    return is_number(x) || is_string(x);
+    return is_number(x) || is_string(x) || null(x);
 }
 
 bool is_variable(Cell *x) {
     return is_symbol(x);
 }
 
-def_prim_symbol_test(quote)
+def_prim_symbol_test(quote, FormQuote)
 
 Cell *eval_quote(Cell *expr, Environment *env) {
     return cadr(expr);
 }
 
-def_prim_symbol_test(if)
+def_prim_symbol_test(if, FormIf)
 
 Cell *eval_if(Cell *expr, Environment *env) {
     Cell *result = eval(cadr(expr), env);
-    if (is_error(result))
-        return result;
-    else if (null(result)) {
-        return null(cdr(cdr(expr)))
-            ? eval(cadr(cdr(expr)), env)
-            : nil();
+    if (null(result)) {
+        return null(cdr(cddr(expr)))
+            ? nil()
+            : eval(cadr(cddr(expr)), env);
     } else {
         return eval(caddr(expr), env);
     }
 }
 
-def_prim_symbol_test_manual(assignment, "set!")
+def_prim_symbol_test(assignment, FormAssignment)
 
 Cell *eval_assignment(Cell *exp, Environment *env) {
     Cell *var = cadr(exp);
-    Cell *val = caddr(exp);
+    Cell *val = eval(caddr(exp), env);
     return env_set_variable_value(var, val, env);
 }
 
-def_prim_symbol_test(lambda) // need this test for (eval (lambda ()))
+def_prim_symbol_test(lambda, FormLambda) // need this test for (eval (lambda ()))
 /* def_prim_symbol_test(procedure); */
 
-Cell *make_procedure(Cell *param, Cell *body, Environment *env) {
+#define procedure_name(x) \
+    (null(proc_name(x)) ? "lambda" : (char*)((Cell*)proc_name(x))->val)
+
+// Escape analysis: the frame of a call can only outlive it if the body
+// closes over it with a lambda, a future or a promise or adds to it with
+// a define. Quoted data is not told apart from code, which only errs on
+// the safe side. Macro calls have to be expanded first, see expand_macros.
+static bool captures_env(Cell *x) {
+    for (; is_pair(x); x = cdr(x)) {
+        if (captures_env(car(x)))
+            return true;
+    }
+    switch (symbol_form(x)) {
+    case FormLambda:
+    case FormDefine:
+    case FormDefineMacro:
+    case FormFuture:
+    case FormDelay:
+    case FormConsStream:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Replaces the call expr with its expansion by rewriting the cons in
+// place, so each use is expanded once however often it runs.
+static void rewrite_call(Cell *expr, Cell *expansion) {
+    if (is_pair(expansion)) {
+        set_car(expr, car(expansion));
+        set_cdr(expr, cdr(expansion));
+    } else {
+        set_car(expr, intern("begin"));
+        set_cdr(expr, cons(expansion, nil()));
+    }
+}
+
+// A copy of the pairs of the code x. The expansions of a macro share what
+// it quotes, and a call site caches its callee for the scope of one use,
+// see lookup_callee.
+static Cell *copy_code(Cell *x) {
+    if (!is_pair(x))
+        return x;
+    return cons(copy_code(car(x)), copy_code(cdr(x)));
+}
+
+#define expand(macro, expr) copy_code(apply(macro, cdr(expr)))
+#define expand_macro(macro, expr) rewrite_call(expr, expand(macro, expr))
+
+static Cell *lookup_macro(Cell *var, Environment *env) {
+    Environment *scope = NULL;
+    Cell *pair = env_lookup_binding(var, env, &scope);
+    return !null(pair) && is_macro(cdr(pair)) ? cdr(pair) : NULL;
+}
+
+// Expands the calls of the macros defined in env anywhere in the code x.
+// Quoted data and quasiquote templates are left alone, the parameter
+// lists of lambda and define are not code either.
+void expand_macros(Cell *x, Environment *env) {
+    if (!is_pair(x))
+        return;
+    Cell *op = car(x);
+    SpecialForm form = symbol_form(op);
+    if (form == FormQuote || form == FormQuasiquote)
+        return;
+    Cell *macro = is_symbol(op) ? lookup_macro(op, env) : NULL;
+    if (macro) {
+        expand_macro(macro, x);
+        expand_macros(x, env);
+        return;
+    }
+    if (form == FormLambda
+        || ((form == FormDefine || form == FormDefineMacro)
+            && is_pair(cdr(x)) && is_pair((Cell*)cadr(x))))
+        x = cdr(x);
+    for (x = cdr(x); is_pair(x); x = cdr(x)) {
+        expand_macros(car(x), env);
+    }
+}
+
+// Expands the macro calls of body once, before its escape analysis. A
+// macro defined after that is expanded when its call is first evaluated.
+// False when body is not expanded: while futures run, the code may be
+// in use by other threads and is left alone.
+static bool expand_body(Cell *body, Environment *env) {
+    if (!is_pair(body) || body->flags & CELL_EXPANDED)
+        return true;
+    if (vm_parallel(getVM()))
+        return false;
+    dolist_cdr(exp, body) {
+        expand_macros(car(exp), env);
+    }
+    body->flags |= CELL_EXPANDED;
+    return true;
+}
+
+// A body that is not expanded may hide a lambda in a macro call, its
+// frames go in the heap.
+Cell *make_procedure(Cell *name, Cell *param, Cell *body, Environment *env) {
     /* Cell *param = cadr(exp); */
     /* Cell *body = caddr(exp); */
-    Procedure *proc = calloc(1, sizeof(Procedure));
-    proc->param = param;
-    proc->body = body;
-    proc->env = env;
-    return make_cell(TypeProcedure, proc);
+    bool expanded = expand_body(body, env);
+    if (expanded && getVM()->optimize
+        && !(is_pair(body) && body->flags & CELL_OPTIMIZED))
+        body = optimize_body(body, param, env);
+    Cell *proc = make_cell(TypeProcedure, cons(name, cons(param, body)));
+    proc->next = env;
+    if (expanded && !captures_env(body))
+        proc->flags |= CELL_LOCAL_FRAME;
+    return proc;
 }
 
 Cell *eval_lambda(Cell *exp, Environment *env) {
-    return make_procedure(cadr(exp), caddr(exp), env);
+    return make_procedure(nil(), cadr(exp), cddr(exp), env);
 }
 
-def_prim_symbol_test(define)
+def_prim_symbol_test(define, FormDefine)
 
 Cell *eval_definition(Cell *expr, Environment *env) {
+    if (null(cdr(expr)))
+        raise_error("malformed definition%s", "");
     Cell *var = cadr(expr);
     if (is_pair(var)) {
         debuglog1("defining a function\n");
         Cell *fn_name = car(var);
         Cell *args = cdr(var);
-        Cell *proc = make_procedure(args, cddr(expr), env); 
+        Cell *proc = make_procedure(fn_name, args, cddr(expr), env); 
         env_add_var_def(fn_name, proc, env);
         debuglog1("function defined\n");
         return proc;
     } else {
-        Cell *val = caddr(expr);
+        Cell *val = eval(caddr(expr), env);
+        // (define f (lambda ...)) names the lambda
+        if (is_procedure(val) && null(proc_name(val)))
+            set_car(car(val), var);
         env_add_var_def(var, val, env);
         return val;
     }
 }
 
+def_prim_symbol_test(define_macro, FormDefineMacro)
+
+// (define-macro (name . params) body...) defines a procedure applied to
+// the forms of a call, whose value is evaluated in their place
+Cell *eval_define_macro(Cell *expr, Environment *env) {
+    Cell *head = null(cdr(expr)) ? nil() : cadr(expr);
+    if (!is_pair(head))
+        raise_error("malformed macro definition%s", "");
+    Cell *name = car(head);
+    Cell *macro = make_procedure(name, cdr(head), cddr(expr), env);
+    macro->flags |= CELL_MACRO;
+    env_add_var_def(name, macro, env);
+    return macro;
+}
+
+def_prim_symbol_test(inlined, FormInlined)
+
+// (%inlined binding callee expansion call) stands for a call the optimizer
+// inlined or folded, expansion holds while the global binding has callee
+Cell *eval_inlined(Cell *expr, Environment *env) {
+    Cell *args = cdr(expr);
+    Cell *binding = car(args);
+    Cell *rest = cdr(args);
+    return cdr(binding) == car(rest)
+        ? eval(cadr(rest), env)
+        : eval(caddr(rest), env);
+}
+
+def_prim_symbol_test(quasiquote, FormQuasiquote)
+def_prim_symbol_test(unquote, FormUnquote)
+def_prim_symbol_test(unquote_splicing, FormUnquoteSplicing)
+
+static Cell *append(Cell *x, Cell *y) {
+    if (null(x))
+        return y;
+    ensure(x, TypePair);
+    Cell *head = car(x);
+    return cons(head, append(cdr(x), y));
+}
+
+// The template with its unquoted parts evaluated, left to right. Nested
+// quasiquotes are not told apart, their unquotes are evaluated as well.
+static Cell *quasi(Cell *x, Environment *env) {
+    if (!is_pair(x))
+        return x;
+    if (is_unquote(x))
+        return eval(cadr(x), env);
+    Cell *head = car(x);
+    if (is_pair(head) && is_unquote_splicing(head)) {
+        Cell *spliced = eval(cadr(head), env);
+        return append(spliced, quasi(cdr(x), env));
+    }
+    head = quasi(head, env);
+    return cons(head, quasi(cdr(x), env));
+}
+
+Cell *eval_quasiquote(Cell *expr, Environment *env) {
+    return quasi(cadr(expr), env);
+}
+
 /* Cell *make_lambda(Cell *param, Cell *body) { */
 /*     Cell *name = intern("lambda"); */
 /*     return make_cCell(3, &name, param, body); */
 /* } */
 
-def_prim_symbol_test_manual(sequence, "begin")
+def_prim_symbol_test(sequence, FormSequence)
 
+// The values before the last are not kept, a collection while the rest
+// is evaluated would take them for in use, see gc_eval. Nor is what the
+// frames of those that allocated left on the stack.
 Cell *eval_sequence(Cell *exps, Environment *env) {
-    Cell *out = nil();
-    dolist_cdr(exp, exps) {
-        out = eval(car(exp), env);
-        if (is_error(out))
-            return out;
+    if (null(exps))
+        return nil();
+    Mutator *m = getMutator();
+    for (; !null(cdr(exps)); exps = cdr(exps)) {
+        unsigned long refills = m->refills;
+        eval(car(exps), env);
+        if (m->refills != refills)
+            stack_clear();
     }
-    return out;
+    return eval(car(exps), env);
 }
 
 Cell *eval_begin(Cell *expr, Environment *env) {
     return eval_sequence(cdr(expr), env);
 }
 
+def_prim_symbol_test(catch, FormCatch)
+
+// (catch exp handler) is the value of exp or, when evaluating it raises a
+// condition, of (handler condition).
+Cell *eval_catch(Cell *expr, Environment *env) {
+    Mutator *m = getMutator();
+    Handler handler;
+    if (handler_enter(m, &handler) == 0) {
+        Cell *result = eval(cadr(expr), env);
+        handler_leave(m, &handler);
+        return result;
+    }
+    Cell *fn = eval(caddr(expr), env);
+    Cell *argv[] = {handler.condition};
+    return apply_argv(fn, 1, argv);
+}
+
+def_prim_symbol_test(unwind_protect, FormUnwindProtect)
+
+// (unwind-protect exp cleanup...) evaluates the cleanup forms after exp,
+// whether it returns or raises. A condition is raised on afterwards.
+Cell *eval_unwind_protect(Cell *expr, Environment *env) {
+    Mutator *m = getMutator();
+    Handler handler;
+    if (handler_enter(m, &handler) == 0) {
+        Cell *result = eval(cadr(expr), env);
+        handler_leave(m, &handler);
+        eval_sequence(cddr(expr), env);
+        return result;
+    }
+    eval_sequence(cddr(expr), env);
+    lisp_raise(handler.condition);
+}
+
+def_prim_symbol_test(future_form, FormFuture)
+
+// (future exp...) evaluates the body as a procedure of no arguments on a
+// worker, see pool.h.
+Cell *eval_future(Cell *expr, Environment *env) {
+    return make_future(make_procedure(nil(), nil(), cdr(expr), env), nil());
+}
+
+def_prim_symbol_test(delay, FormDelay)
+
+// (delay exp...) is a promise of the body as a procedure of no arguments,
+// see stream.h
+Cell *eval_delay(Cell *expr, Environment *env) {
+    return make_promise(make_procedure(nil(), nil(), cdr(expr), env), nil());
+}
+
+def_prim_symbol_test(cons_stream, FormConsStream)
+
+// (cons-stream a exp...) is (cons a (delay exp...))
+Cell *eval_cons_stream(Cell *expr, Environment *env) {
+    Cell *first = eval(cadr(expr), env);
+    return cons(first, make_promise(make_procedure(nil(), nil(), cddr(expr),
+                                                   env), nil()));
+}
+
+def_prim_symbol_test(stream_fold, FormStreamFold)
+
+// (stream-fold f init s) evaluates its arguments after the point the
+// cells it collects begin, onto the thread's stack, see stream.h
+Cell *eval_stream_fold(Cell *expr, Environment *env) {
+    if (length(expr) != 4)
+        raise_error("wrong number of arguments to stream-fold, %d",
+                    length(expr) - 1);
+    VM *vm = getVM();
+    Mutator *m = getMutator();
+    if (m->stackSize + 3 > STACK_MAX)
+        raise_error("folds nested too deep, %d", m->stackSize);
+    int base = m->stackSize;
+    unsigned long collections = vm->evalCollections;
+    long young = gc_young_start(vm);
+    vm_push(m, eval(cadr(expr), env));
+    vm_push(m, eval(caddr(expr), env));
+    vm_push(m, eval(car(cdr(cddr(expr))), env));
+    // cells may have moved across young while they were evaluated
+    if (vm->evalCollections != collections)
+        young = vm->next - vm->heap;
+    return stream_fold(&m->stack[base], young);
+}
+
 Cell *list_of_values(Cell *expr, Environment *env) {
     if (null(expr)) {
         return nil();
     } else {
         Cell *c = eval(car(expr), env);
-        if (is_error(c))
-            return c;
         return cons(c, list_of_values(cdr(expr), env));
     }
 }
 
-Cell *apply(Cell *func, Cell *args) {
-    if (is_procedure(func)) {
-        debuglog1("procedure - ");
-        debugObj(func, ", ");
-        debuglnObj(args);
-        Procedure *proc = func->val;
-        //
-        Cell *arg_syms = proc->param;
-        Cell *body = proc->body;
-        Environment *env = proc->env;
-        env = env_extend_stack(arg_syms, args, env);
-        return eval_sequence(body, env);
-    }
-    else if (is_primitive(func)) {
-        debuglog1("primitive - ");
-        debugObj(func, ", ");
-        debuglnObj(args);
-        return ((PrimLispFn)func->val)(args);
+// whether argc arguments can be bound to params, a dotted list takes
+// any number past the ones before the dot
+static bool arity_matches(Cell *params, int argc) {
+    for (; is_pair(params); params = cdr(params)) {
+        argc--;
+    }
+    return null(params) ? argc == 0 : argc >= 0;
+}
+
+// Arguments come in an array like for primitives, the list of them would
+// never outlive the call anyway.
+Cell *apply_procedure(Cell *func, int argc, Cell **argv) {
+    debuglog("procedure - %s, argc = %d\n", procedure_name(func), argc);
+    VM *vm = getVM();
+    Mutator *m = getMutator();
+    stats_call(m, procedure_name(func));
+    census_poll(vm);
+    interrupt_poll(vm, m);
+    gc_poll(vm, m);
+    //
+    Cell *arg_syms = proc_param(func);
+    Cell *body = proc_body(func);
+    Environment *env = proc_env(func);
+    if (!arity_matches(arg_syms, argc)) {
+        raise_error("wrong number of arguments to %s, %d",
+                    procedure_name(func), argc);
+    }
+    shadow_push(m, procedure_name(func));
+    Cell *mark = m->regionNext;
+    env = func->flags & CELL_LOCAL_FRAME
+        ? env_extend_region(m, arg_syms, argc, argv, env)
+        : env_extend_stack(arg_syms, argc, argv, env);
+    Cell *result = eval_sequence(body, env);
+    m->regionNext = mark;
+    shadow_pop(m);
+    return result;
+}
+
+// The arity is checked here, before the primitive ever sees argv.
+Cell *apply_primitive(Cell *func, int argc, Cell **argv) {
+    const PrimDef *def = prim_def(func);
+    debuglog("primitive - %s, argc = %d\n", def->name, argc);
+    Mutator *m = getMutator();
+    stats_call(m, def->name);
+    if (argc < def->minArgs
+        || (def->maxArgs != ARGS_MANY && argc > def->maxArgs)) {
+        raise_error("wrong number of arguments to %s, %d", def->name, argc);
+    }
+    shadow_push(m, def->name);
+    Cell *result = def->fn(argc, argv);
+    shadow_pop(m);
+    return result;
+}
+
+Cell *apply_argv(Cell *func, int argc, Cell **argv) {
+    if (is_primitive(func)) {
+        return apply_primitive(func, argc, argv);
+    }
+    else if (is_procedure(func)) {
+        return apply_procedure(func, argc, argv);
     }
     debuglog1("");
-    debugObj(func, ", ");
-    debuglnObj(args);
-    return_error("unsupported function %s", "\n");
+    debugObj(func, "\n");
+    raise_error("unsupported function %s", "\n");
+}
+
+Cell *apply(Cell *func, Cell *args) {
+    Cell *argv[length(args) + 1];
+    int argc = 0;
+    dolist_cdr(arg, args) {
+        argv[argc++] = car(arg);
+    }
+    return apply_argv(func, argc, argv);
+}
+
+#define call_cache_entry(m, site) \
+    (&(m)->callCache[((uintptr_t)(site) / sizeof(Cell)) & (CALL_CACHE_SIZE - 1)])
+
+// The callee of the call site expr, whose operator is the symbol var. A
+// site whose operator resolved to a global procedure or primitive keeps
+// it until the bindings version changes; anything else is looked up. A
+// site is code of one scope, expansions are copies, see copy_code.
+//
+// Other threads may change the binding meanwhile: the entry gets the
+// version from before the lookup, and the binding is flagged before its
+// value is read again, so a set! either sees the flag or is seen.
+static Cell *lookup_callee(VM *vm, Mutator *m, Cell *expr, Cell *var,
+                           Environment *env) {
+    unsigned long version = __atomic_load_n(&vm->bindingsVersion,
+                                            __ATOMIC_ACQUIRE);
+    CallCache *entry = call_cache_entry(m, expr);
+    if (entry->site == expr && entry->version == version) {
+        stats_call_cache(m, true);
+        return entry->callee;
+    }
+    stats_call_cache(m, false);
+
+    Environment *scope = NULL;
+    Cell *pair = env_lookup_binding(var, env, &scope);
+    if (null(pair))
+        return env_lookup_var(var, env);
+    Cell *callee = cdr(pair);
+    if (null(cdr(scope)) && !is_macro(callee)
+        && (is_procedure(callee) || is_primitive(callee))) {
+        __atomic_or_fetch(&pair->flags, CELL_CACHED_BINDING, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pair->next, __ATOMIC_SEQ_CST) == callee)
+            *entry = (CallCache){.site = expr, .callee = callee,
+                                 .kind = callee->type, .version = version};
+    }
+    return callee;
+}
+
+// The first evaluation of a macro call. The frame of a CELL_LOCAL_FRAME
+// procedure cannot be captured, so an expansion that would, from a macro
+// defined after the procedure, is evaluated in a heap copy of the frame,
+// see env_to_heap. It is not rewritten then and each call expands it
+// again, into a frame of its own. That holds for the calls whose frame did
+// not fit in the region too: the next ones may.
+// While futures run, other threads may be evaluating expr: the expansion
+// is evaluated without rewriting anything, the macro calls in it as well.
+static Cell *eval_macro_call(Cell *macro, Cell *expr, Environment *env) {
+    Cell *expansion = expand(macro, expr);
+    bool shared = vm_parallel(getVM());
+    if (!shared)
+        expand_macros(expansion, env);
+    if (env->flags & CELL_LOCAL_FRAME && captures_env(expansion)) {
+        Environment *heap = env_to_heap(env);
+        Cell *result = eval(expansion, heap);
+        // what it defined is in the rest of the body's scope as well
+        set_car(env, car(heap));
+        return result;
+    }
+    if (shared)
+        return eval(expansion, env);
+    rewrite_call(expr, expansion);
+    return eval(expr, env);
 }
 
 Cell *eval_apply(Cell *expr, Environment *env) {
     debuglog1("");
     debugObj(expr, ", ");
-    printf("env = %p\n", (void*)env);
+    debuglog("env = %p\n", (void*)env);
     Cell *var = car(expr);
     Cell *args = cdr(expr);
-    Cell *fn = eval(var, env);
+    Cell *fn = is_symbol(var)
+        ? lookup_callee(getVM(), getMutator(), expr, var, env)
+        : eval(var, env);
 
-    if (is_error(fn))
-        return fn;
-    else if (null(fn)) {
+    if (null(fn)) {
         return nil();
     }
+    else if (is_macro(fn)) {
+        return eval_macro_call(fn, expr, env);
+    }
 
-    // some low level manipulation to make code more transparent.
-    Cell *acc = make_cell(TypePair, NULL);
-    Cell *ptr = acc;
+    // arguments are evaluated onto the C stack, nothing is consed
+    Cell *argv[length(args) + 1];
+    int argc = 0;
     dolist_cdr(arg, args) {
-        Cell *val = eval(car(arg), env);
-        if (is_error(val))
-            return val;
-        acc->next = cons(val, nil());
-        acc = acc->next;
+        argv[argc++] = eval(car(arg), env);
     }
-    Cell *args_vals = ptr->next;
-    ptr->next = NULL;
-    /* Cell *args_vals = list_of_values(args, env); */
-    return apply(fn, args_vals);
+    return apply_argv(fn, argc, argv);
 }
 
 Cell *eval(Cell *exp, Environment *env)
 {
     debuglog1("");
     debugObj(exp, ", ");
-    printf("env = %p\n", (void*)env);
+    debuglog("env = %p\n", (void*)env);
     if (is_self_evaluating(exp)) {
         // dont print, segment fault if exp is number
         /* debuglog("is self evaluate%s\n", (char*)exp->val); */
@@ -204,12 +572,39 @@ Cell *eval(Cell *exp, Environment *env)
         else if (is_define(exp)) {
             return eval_definition(exp, env);
         }
+        else if (is_define_macro(exp)) {
+            return eval_define_macro(exp, env);
+        }
+        else if (is_quasiquote(exp)) {
+            return eval_quasiquote(exp, env);
+        }
+        else if (is_inlined(exp)) {
+            return eval_inlined(exp, env);
+        }
         else if (is_lambda(exp)) {
             return eval_lambda(exp, env);
         }
         else if (is_sequence(exp)) {
             return eval_begin(exp, env);
         }
+        else if (is_catch(exp)) {
+            return eval_catch(exp, env);
+        }
+        else if (is_unwind_protect(exp)) {
+            return eval_unwind_protect(exp, env);
+        }
+        else if (is_future_form(exp)) {
+            return eval_future(exp, env);
+        }
+        else if (is_delay(exp)) {
+            return eval_delay(exp, env);
+        }
+        else if (is_cons_stream(exp)) {
+            return eval_cons_stream(exp, env);
+        }
+        else if (is_stream_fold(exp)) {
+            return eval_stream_fold(exp, env);
+        }
         /* else if (is_application(exp)) { */
         return eval_apply(exp, env);
         /* } */
@@ -220,3 +615,93 @@ Cell *eval(Cell *exp, Environment *env)
     exit(1);
 }
 
+// Reads and evaluates every form of input in env, a condition raised by
+// one stops it. Returns the value of the last form.
+Cell *load(FILE *input, Environment *env) {
+    Cell *result = nil();
+    Cell *exp;
+    while ((exp = lisp_read(input)) != NULL) {
+        result = eval(exp, env);
+    }
+    return result;
+}
+
+
+VM *lisp_open(void) {
+    VM *vm = vm_new();
+    vm_switch(vm);
+    init_environment();
+    return vm;
+}
+
+// NULL if the image cannot be loaded
+VM *lisp_open_image(char *path) {
+    VM *vm = vm_new();
+    vm_switch(vm);
+    if (load_image(path) == NULL) {
+        vm_free(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+void lisp_close(VM *vm) {
+    vm_free(vm);
+}
+
+void lisp_define(VM *vm, char *name, Cell *val) {
+    vm_switch(vm);
+    env_add_var_def(intern(name), val, vm->globals);
+}
+
+// returns NULL at the end of input, an error cell when it cannot be read
+Cell *lisp_read_form(VM *vm, FILE *input) {
+    vm_switch(vm);
+    Handler handler;
+    if (handler_enter(&vm->main, &handler) != 0)
+        return handler.condition;
+    Cell *exp = lisp_read(input);
+    handler_leave(&vm->main, &handler);
+    return exp;
+}
+
+// Evaluates a top level form in the global env. Nothing from a previous
+// evaluation is in use any more, so this is where the heap gets collected.
+// A condition the form does not catch is returned, and *raised set, an
+// error the form evaluates to is only its value.
+Cell *lisp_eval(VM *vm, Cell *exp, bool *raised) {
+    vm_switch(vm);
+    Mutator *m = &vm->main;
+    vm_push(m, exp);
+    gc_safepoint(vm);
+    exp = vm_pop(m);
+    census_poll(vm);
+    *raised = true;
+    Handler handler;
+    if (handler_enter(m, &handler) != 0)
+        return handler.condition;
+    Cell *result = eval(exp, vm->globals);
+    handler_leave(m, &handler);
+    *raised = false;
+    return result;
+}
+
+// Evaluates every form in src, stopping at the first one that cannot be
+// read or raises. Returns the value of the last form, or the condition.
+Cell *lisp_eval_string(VM *vm, char *src, bool *raised) {
+    *raised = true;
+    FILE *input = fmemopen(src, strlen(src), "r");
+    if (input == NULL) {
+        vm_switch(vm);
+        return make_error("ERROR: lisp_eval_string, cannot read");
+    }
+    *raised = false;
+    Cell *result = nil();
+    Cell *exp;
+    while (!*raised && (exp = lisp_read_form(vm, input)) != NULL) {
+        *raised = is_error(exp);
+        result = *raised ? exp : lisp_eval(vm, exp, raised);
+    }
+    fclose(input);
+    return result;
+}
@@ -0,0 +1,337 @@
+#include "optimize.h"
+#include "condition.h"
+#include "lisp.h"
+
+typedef struct {
+    VM *vm;
+    // where the procedure is made, the frames of it besides the global one
+    // are locals of the body as well
+    Environment *env;
+    // symbols the body set!s or defines anywhere
+    Cell *assigned;
+} Optimizer;
+
+#define is_form(x, form) (is_pair(x) && symbol_form((Cell*)car(x)) == (form))
+
+// primitives without effects, whose value only depends on the arguments
+static const char *pure_prims[] = {"+", "-", "*", "=", "<", "eq", "car", "cdr",
+                                   "atom?"};
+
+#define PURE_PRIMS_COUNT (sizeof(pure_prims) / sizeof(pure_prims[0]))
+
+static Cell *optimize(Optimizer *o, Cell *x, Cell *scope, int depth);
+
+static bool memq(Cell *x, Cell *list) {
+    dolist_cdr(e, list) {
+        if (car(e) == x)
+            return true;
+    }
+    return false;
+}
+
+static bool is_constant(Cell *x) {
+    return is_number(x) || is_string(x) || null(x) || is_form(x, FormQuote);
+}
+
+static Cell *constant_value(Cell *x) {
+    return is_form(x, FormQuote) ? cadr(x) : x;
+}
+
+static Cell *quote_constant(Cell *value) {
+    return is_number(value) || is_string(value) || null(value)
+        ? value : make_cCell(2, intern("quote"), value);
+}
+
+static Cell *make_inlined(Cell *binding, Cell *callee, Cell *expansion,
+                          Cell *call) {
+    return make_cCell(5, intern("%inlined"), binding, callee, expansion, call);
+}
+
+#define inlined_expansion(x) car(cdr(cddr(x)))
+#define inlined_call(x)      car(cddr(cddr(x)))
+
+// the parameters, a dotted list included, in front of scope
+static Cell *bind_params(Cell *params, Cell *scope) {
+    for (; is_pair(params); params = cdr(params)) {
+        scope = cons(car(params), scope);
+    }
+    return null(params) ? scope : cons(params, scope);
+}
+
+static bool is_local(Optimizer *o, Cell *var, Cell *scope) {
+    if (memq(var, scope) || memq(var, o->assigned))
+        return true;
+    for (Environment *env = o->env; !null(cdr(env)); env = cdr(env)) {
+        if (!null(assoc(var, car(env))))
+            return true;
+    }
+    return false;
+}
+
+static Cell *collect_assigned(Cell *x, Cell *acc) {
+    if (!is_pair(x) || is_form(x, FormQuote))
+        return acc;
+    if ((is_form(x, FormAssignment) || is_form(x, FormDefine))
+        && is_pair(cdr(x))) {
+        Cell *target = cadr(x);
+        acc = cons(is_pair(target) ? car(target) : target, acc);
+    }
+    for (; is_pair(x); x = cdr(x)) {
+        acc = collect_assigned(car(x), acc);
+    }
+    return acc;
+}
+
+// what can be put in place of a parameter: evaluating it has no effect
+// and gives the same value wherever it is moved to
+static bool is_simple(Optimizer *o, Cell *x, Cell *scope) {
+    return is_constant(x)
+        || (is_symbol(x) && memq(x, scope) && !memq(x, o->assigned));
+}
+
+// leaving it out of a sequence changes nothing
+static bool is_pure(Optimizer *o, Cell *x, Cell *scope) {
+    return is_simple(o, x, scope) || is_form(x, FormLambda);
+}
+
+// code without forms that bind, assign or quote code, parameters can be
+// substituted into it
+static bool is_leaf(Cell *x) {
+    if (!is_pair(x) || is_form(x, FormQuote))
+        return true;
+    if (is_form(x, FormInlined))
+        return is_leaf(inlined_expansion(x)) && is_leaf(inlined_call(x));
+    if (is_form(x, FormLambda) || is_form(x, FormDefine)
+        || is_form(x, FormAssignment) || is_form(x, FormDefineMacro)
+        || is_form(x, FormQuasiquote))
+        return false;
+    for (; is_pair(x); x = cdr(x)) {
+        if (!is_leaf(car(x)))
+            return false;
+    }
+    return true;
+}
+
+static int size(Cell *x) {
+    if (!is_pair(x) || is_form(x, FormQuote))
+        return 1;
+    int n = 0;
+    for (; is_pair(x); x = cdr(x)) {
+        n += size(car(x));
+    }
+    return n;
+}
+
+static bool mentions(Cell *x, Cell *var) {
+    for (; is_pair(x); x = cdr(x)) {
+        if (mentions(car(x), var))
+            return true;
+    }
+    return x == var;
+}
+
+// whether a variable of the body of a global procedure, besides its
+// parameters, would mean something else inlined into this scope
+static bool captured(Optimizer *o, Cell *x, Cell *params, Cell *scope) {
+    if (is_symbol(x))
+        return !memq(x, params) && is_local(o, x, scope);
+    if (!is_pair(x) || is_form(x, FormQuote))
+        return false;
+    if (is_form(x, FormInlined))
+        return captured(o, inlined_expansion(x), params, scope)
+            || captured(o, inlined_call(x), params, scope);
+    for (; is_pair(x); x = cdr(x)) {
+        if (captured(o, car(x), params, scope))
+            return true;
+    }
+    return false;
+}
+
+static Cell *subst(Cell *x, Cell *params, Cell *args) {
+    if (is_symbol(x)) {
+        for (; is_pair(params); params = cdr(params), args = cdr(args)) {
+            if (car(params) == x)
+                return car(args);
+        }
+        return x;
+    }
+    if (!is_pair(x) || is_form(x, FormQuote))
+        return x;
+    if (is_form(x, FormInlined)) {
+        Cell *rest = cdr(x);
+        return make_inlined(car(rest), cadr(rest),
+                            subst(inlined_expansion(x), params, args),
+                            subst(inlined_call(x), params, args));
+    }
+    Cell *head = subst(car(x), params, args);
+    return cons(head, subst(cdr(x), params, args));
+}
+
+// the body with args in place of params, as one form
+static Cell *subst_body(Cell *body, Cell *params, Cell *args) {
+    Cell *forms = subst(body, params, args);
+    return null(cdr(forms)) ? car(forms) : cons(intern("begin"), forms);
+}
+
+static bool substitutable(Optimizer *o, Cell *params, Cell *args, Cell *body,
+                          Cell *scope) {
+    for (; is_pair(params) && is_pair(args);
+         params = cdr(params), args = cdr(args)) {
+        if (!is_simple(o, car(args), scope))
+            return false;
+    }
+    return null(params) && null(args) && is_pair(body) && is_leaf(body);
+}
+
+static Cell *optimize_list(Optimizer *o, Cell *x, Cell *scope, int depth) {
+    if (!is_pair(x))
+        return x;
+    Cell *head = optimize(o, car(x), scope, depth);
+    return cons(head, optimize_list(o, cdr(x), scope, depth));
+}
+
+// the forms of a body or a begin, all but the last only count for their
+// effects
+static Cell *optimize_sequence(Optimizer *o, Cell *body, Cell *scope,
+                               int depth) {
+    if (!is_pair(body))
+        return body;
+    Cell *head = optimize(o, car(body), scope, depth);
+    Cell *rest = optimize_sequence(o, cdr(body), scope, depth);
+    if (!null(rest) && is_pure(o, head, scope))
+        return rest;
+    return cons(head, rest);
+}
+
+static Cell *optimize_lambda_body(Optimizer *o, Cell *params, Cell *body,
+                                  Cell *scope, int depth) {
+    Cell *out = optimize_sequence(o, body, bind_params(params, scope), depth);
+    if (is_pair(out))
+        out->flags |= CELL_OPTIMIZED | CELL_EXPANDED;
+    return out;
+}
+
+static Cell *optimize_if(Optimizer *o, Cell *x, Cell *scope, int depth) {
+    int n = length(x);
+    if (n != 3 && n != 4)
+        return x;
+    Cell *test = optimize(o, cadr(x), scope, depth);
+    Cell *conseq = optimize(o, caddr(x), scope, depth);
+    Cell *alt = n == 4 ? optimize(o, cadr(cddr(x)), scope, depth) : nil();
+    if (is_constant(test))
+        return null(constant_value(test)) ? alt : conseq;
+    return n == 4
+        ? make_cCell(4, car(x), test, conseq, alt)
+        : make_cCell(3, car(x), test, conseq);
+}
+
+static bool is_pure_prim(const PrimDef *def) {
+    for (size_t i = 0; i < PURE_PRIMS_COUNT; i++) {
+        if (string_eq(pure_prims[i], def->name))
+            return lookup_prim(def->name) == def;
+    }
+    return false;
+}
+
+// A pure primitive applied to constants. When it raises, the call is left
+// to raise when it runs.
+static Cell *fold(Optimizer *o, Cell *x, Cell *binding) {
+    Cell *prim = cdr(binding);
+    const PrimDef *def = prim_def(prim);
+    int argc = length(cdr(x));
+    if (!is_pure_prim(def) || argc < def->minArgs
+        || (def->maxArgs != ARGS_MANY && argc > def->maxArgs))
+        return x;
+    Cell *argv[argc + 1];
+    int i = 0;
+    dolist_cdr(arg, cdr(x)) {
+        if (!is_constant(car(arg)))
+            return x;
+        argv[i++] = constant_value(car(arg));
+    }
+    Handler handler;
+    Mutator *m = getMutator();
+    if (handler_enter(m, &handler) != 0)
+        return x;
+    Cell *value = def->fn(argc, argv);
+    handler_leave(m, &handler);
+    return make_inlined(binding, prim, quote_constant(value), x);
+}
+
+// ((lambda params body...) args...)
+static Cell *beta(Optimizer *o, Cell *x, Cell *scope, int depth) {
+    Cell *lambda = car(x);
+    Cell *params = is_pair(cdr(lambda)) ? cadr(lambda) : nil();
+    Cell *body = is_pair(cdr(lambda)) ? cddr(lambda) : nil();
+    if (depth >= INLINE_DEPTH_MAX
+        || !substitutable(o, params, cdr(x), body, scope))
+        return x;
+    return optimize(o, subst_body(body, params, cdr(x)), scope, depth + 1);
+}
+
+// a small global procedure that does not call itself
+static Cell *inline_call(Optimizer *o, Cell *x, Cell *binding, Cell *scope,
+                         int depth) {
+    Cell *callee = cdr(binding);
+    Cell *params = proc_param(callee);
+    Cell *body = proc_body(callee);
+    if (depth >= INLINE_DEPTH_MAX || is_macro(callee)
+        || proc_env(callee) != o->vm->globals
+        || mentions(body, car(binding)) || size(body) > INLINE_SIZE_MAX
+        || !substitutable(o, params, cdr(x), body, scope)
+        || captured(o, body, params, scope))
+        return x;
+    Cell *expansion = optimize(o, subst_body(body, params, cdr(x)), scope,
+                               depth + 1);
+    return make_inlined(binding, callee, expansion, x);
+}
+
+static Cell *optimize_call(Optimizer *o, Cell *x, Cell *scope, int depth) {
+    Cell *op = car(x);
+    if (is_form(op, FormLambda))
+        return beta(o, x, scope, depth);
+    if (!is_symbol(op) || is_local(o, op, scope))
+        return x;
+    Cell *binding = assoc(op, car(o->vm->globals));
+    if (null(binding))
+        return x;
+    Cell *callee = cdr(binding);
+    if (is_primitive(callee))
+        return fold(o, x, binding);
+    if (is_procedure(callee))
+        return inline_call(o, x, binding, scope, depth);
+    return x;
+}
+
+static Cell *optimize(Optimizer *o, Cell *x, Cell *scope, int depth) {
+    if (!is_pair(x) || is_form(x, FormQuote) || is_form(x, FormQuasiquote)
+        || is_form(x, FormDefineMacro) || is_form(x, FormInlined))
+        return x;
+    Cell *op = car(x);
+    if (is_form(x, FormIf))
+        return optimize_if(o, x, scope, depth);
+    if (is_form(x, FormSequence)) {
+        Cell *forms = optimize_sequence(o, cdr(x), scope, depth);
+        return is_pair(forms) && null(cdr(forms))
+            ? car(forms) : cons(op, forms);
+    }
+    if (!is_pair(cdr(x)))
+        return optimize_call(o, x, scope, depth);
+    Cell *target = cadr(x);
+    if (is_form(x, FormLambda))
+        return cons(op, cons(target, optimize_lambda_body(o, target, cddr(x),
+                                                          scope, depth)));
+    if (is_form(x, FormDefine) && is_pair(target))
+        return cons(op, cons(target, optimize_lambda_body(o, cdr(target),
+                                                          cddr(x), scope,
+                                                          depth)));
+    if (is_form(x, FormDefine) || is_form(x, FormAssignment))
+        return cons(op, cons(target, optimize_list(o, cddr(x), scope, depth)));
+    return optimize_call(o, optimize_list(o, x, scope, depth), scope, depth);
+}
+
+Cell *optimize_body(Cell *body, Cell *params, Environment *env) {
+    Optimizer o = {.vm = getVM(), .env = env,
+                   .assigned = collect_assigned(body, nil())};
+    return optimize_lambda_body(&o, params, body, nil(), 0);
+}
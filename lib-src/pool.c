@@ -0,0 +1,349 @@
+#include <unistd.h>
+#include "pool.h"
+#include "condition.h"
+#include "lisp.h"
+#include "extension.h"
+
+typedef struct Worker {
+    pthread_t thread;
+    Mutator mutator;
+    // Futures waiting, the worker takes them at bottom and the others
+    // steal at top. Slots not in use hold nil.
+    pthread_mutex_t lock;
+    Cell **deque;
+    unsigned long top;
+    unsigned long bottom;
+    VM *vm;
+    struct Pool *pool;
+    int index;
+} Worker;
+
+typedef struct Pool {
+    Worker *workers;
+    int size;
+    // guards running and stopping, work and done are waited for with it
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    // a future got done or a worker stopped running one
+    pthread_cond_t done;
+    // futures in the deques
+    int queued;
+    // workers between taking a future and being done with it
+    int running;
+    // of them, those stopped in the middle of it, see pool_park
+    int parked;
+    bool stopping;
+    bool quit;
+    // where the next future made on the VM's thread goes
+    int nextWorker;
+    // the deques of all workers in a row, a single root range
+    Cell **slots;
+} Pool;
+
+// the worker the calling thread is, NULL on the VM's thread
+static _Thread_local Worker *current_worker = NULL;
+
+static bool deque_push(Worker *w, Cell *future) {
+    pthread_mutex_lock(&w->lock);
+    bool pushed = w->bottom - w->top < POOL_DEQUE_SIZE;
+    if (pushed)
+        w->deque[w->bottom++ % POOL_DEQUE_SIZE] = future;
+    pthread_mutex_unlock(&w->lock);
+    return pushed;
+}
+
+static Cell *deque_take(Worker *w, bool own) {
+    Cell *future = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->top < w->bottom) {
+        Cell **slot = own ? &w->deque[--w->bottom % POOL_DEQUE_SIZE]
+                          : &w->deque[w->top++ % POOL_DEQUE_SIZE];
+        future = *slot;
+        *slot = nil();
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (future != NULL)
+        __atomic_fetch_sub(&w->pool->queued, 1, __ATOMIC_RELAXED);
+    return future;
+}
+
+// a future from the calling worker's deque, else from any other
+static Cell *pool_take(Pool *pool) {
+    Worker *self = current_worker;
+    if (self != NULL) {
+        Cell *future = deque_take(self, true);
+        if (future != NULL)
+            return future;
+    }
+    int start = self != NULL ? self->index + 1 : 0;
+    for (int i = 0; i < pool->size; i++) {
+        Worker *victim = &pool->workers[(start + i) % pool->size];
+        if (victim == self)
+            continue;
+        Cell *future = deque_take(victim, false);
+        if (future != NULL)
+            return future;
+    }
+    return NULL;
+}
+
+static int future_state(Cell *future) {
+    return __atomic_load_n(&future->flags, __ATOMIC_ACQUIRE);
+}
+
+// Runs a future on the calling thread, unless someone else got to it.
+static void run(VM *vm, Cell *future) {
+    unsigned int state = FUTURE_PENDING;
+    if (!__atomic_compare_exchange_n(&future->flags, &state, FUTURE_RUNNING,
+                                     false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE))
+        return;
+    Cell *call = future->val;
+    Mutator *m = getMutator();
+    Handler handler;
+    if (handler_enter(m, &handler) == 0) {
+        future->val = apply(car(call), cdr(call));
+        handler_leave(m, &handler);
+        state = FUTURE_DONE;
+    }
+    else {
+        future->val = handler.condition;
+        state = FUTURE_RAISED;
+    }
+    __atomic_store_n(&future->flags, state, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&vm->tasks, 1, __ATOMIC_RELEASE);
+    Pool *pool = vm->pool;
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Pool *pool = w->pool;
+    current_worker = w;
+    mutator_switch(w->vm, &w->mutator);
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->quit) {
+        if (pool->stopping
+            || __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) == 0) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        pool->running++;
+        pthread_mutex_unlock(&pool->lock);
+        Cell *future = pool_take(pool);
+        if (future != NULL)
+            run(w->vm, future);
+        pthread_mutex_lock(&pool->lock);
+        pool->running--;
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int pool_size(void) {
+    char *env = getenv("LISP_WORKERS");
+    long n = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (n < 1) n = 1;
+    if (n > POOL_WORKERS_MAX) n = POOL_WORKERS_MAX;
+    return n;
+}
+
+static Pool *pool_start(VM *vm) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    pool->size = pool_size();
+    pool->workers = calloc(pool->size, sizeof(Worker));
+    pool->slots = malloc(pool->size * POOL_DEQUE_SIZE * sizeof(Cell*));
+    for (int i = 0; i < pool->size * POOL_DEQUE_SIZE; i++) {
+        pool->slots[i] = nil();
+    }
+    ext_gc_root_array(vm, pool->slots, pool->size * POOL_DEQUE_SIZE);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    vm->pool = pool;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, POOL_STACK_SIZE);
+    for (int i = 0; i < pool->size; i++) {
+        Worker *w = &pool->workers[i];
+        mutator_init(&w->mutator);
+        pthread_mutex_init(&w->lock, NULL);
+        w->deque = pool->slots + i * POOL_DEQUE_SIZE;
+        w->vm = vm;
+        w->pool = pool;
+        w->index = i;
+        if (pthread_create(&w->thread, &attr, worker_main, w) != 0) {
+            perror("Cannot start worker");
+            exit(1);
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return pool;
+}
+
+Cell *make_future(Cell *fn, Cell *args) {
+    VM *vm = getVM();
+    Pool *pool = vm->pool != NULL ? vm->pool : pool_start(vm);
+    Cell *future = make_cell(TypeFuture, cons(fn, args));
+    future->flags = FUTURE_PENDING;
+    __atomic_fetch_add(&vm->tasks, 1, __ATOMIC_RELEASE);
+
+    Worker *w = current_worker;
+    if (w == NULL) {
+        w = &pool->workers[pool->nextWorker];
+        pool->nextWorker = (pool->nextWorker + 1) % pool->size;
+    }
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_RELAXED);
+    if (!deque_push(w, future)) {
+        __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_RELAXED);
+        run(vm, future);
+        return future;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return future;
+}
+
+Cell *touch(Cell *x) {
+    if (!is_future(x))
+        return x;
+    VM *vm = getVM();
+    Pool *pool = vm->pool;
+    Mutator *m = getMutator();
+    run(vm, x);
+    // running on another thread, help with the others meanwhile, and
+    // collect or park as the threads running them allocate
+    while (future_state(x) == FUTURE_RUNNING) {
+        gc_poll(vm, m);
+        Cell *other = pool_take(pool);
+        if (other != NULL) {
+            run(vm, other);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (future_state(x) == FUTURE_RUNNING
+            && __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) == 0
+            && !pool->stopping && !gc_due(vm))
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (future_state(x) == FUTURE_RAISED)
+        lisp_raise(x->val);
+    return x->val;
+}
+
+// The futures are all made before any is touched, the list of them
+// becomes the list of values.
+Cell *pmap(Cell *fn, Cell *list) {
+    Cell *futures = nil();
+    Cell *last = NULL;
+    dolist_cdr(x, list) {
+        ensure(x, TypePair);
+        Cell *pair = cons(make_future(fn, cons(car(x), nil())), nil());
+        if (last == NULL)
+            futures = pair;
+        else
+            cdr(last) = pair;
+        last = pair;
+    }
+    dolist_cdr(x, futures) {
+        car(x) = touch(car(x));
+    }
+    return futures;
+}
+
+// The workers waiting in touch are woken up to park as well.
+void pool_stop(VM *vm) {
+    Pool *pool = vm->pool;
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    __atomic_store_n(&vm->stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->done);
+    while (pool->running > pool->parked) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_resume(VM *vm) {
+    Pool *pool = vm->pool;
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = false;
+    __atomic_store_n(&vm->stopping, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_park(VM *vm) {
+    Worker *w = current_worker;
+    Pool *pool = vm->pool;
+    if (w == NULL || pool == NULL)
+        return;
+    // callee saved registers go to this frame, below which the collector
+    // scans
+    __builtin_unwind_init();
+    mutator_park(&w->mutator);
+    pthread_mutex_lock(&pool->lock);
+    pool->parked++;
+    pthread_cond_broadcast(&pool->done);
+    while (pool->stopping) {
+        pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    pool->parked--;
+    pthread_mutex_unlock(&pool->lock);
+    w->mutator.parkedAt = NULL;
+}
+
+void pool_wake(VM *vm) {
+    Pool *pool = vm->pool;
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+Mutator *pool_mutator(VM *vm, int i) {
+    Pool *pool = vm->pool;
+    return pool != NULL && i < pool->size ? &pool->workers[i].mutator : NULL;
+}
+
+void pool_seal(VM *vm) {
+    Pool *pool = vm->pool;
+    if (pool == NULL)
+        return;
+    for (int i = 0; i < pool->size; i++) {
+        mutator_seal(&pool->workers[i].mutator);
+    }
+}
+
+void pool_free(VM *vm) {
+    Pool *pool = vm->pool;
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->size; i++) {
+        Worker *w = &pool->workers[i];
+        pthread_join(w->thread, NULL);
+        mutator_free(&w->mutator);
+        pthread_mutex_destroy(&w->lock);
+    }
+    ext_gc_unroot(vm, pool->slots);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->slots);
+    free(pool->workers);
+    free(pool);
+    vm->pool = NULL;
+}
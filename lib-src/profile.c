@@ -0,0 +1,110 @@
+#include <signal.h>
+#include <sys/time.h>
+#include "profile.h"
+
+// Samples are stored back to back as their depth followed by that many
+// frame names, outermost first.
+static uintptr_t *buffer = NULL;
+static size_t used = 0;
+static unsigned long dropped = 0;
+
+static VM *volatile profiled_vm = NULL;
+static struct sigaction saved_action;
+
+static void on_sigprof(int sig) {
+    VM *vm = profiled_vm;
+    if (vm == NULL) return;
+
+    Mutator *m = &vm->main;
+    int depth = m->shadowDepth;
+    if (depth > SHADOW_STACK_MAX) depth = SHADOW_STACK_MAX;
+    int first = depth > PROFILE_DEPTH_MAX ? depth - PROFILE_DEPTH_MAX : 0;
+    if (used + (depth - first) + 1 > PROFILE_BUFFER_FRAMES) {
+        dropped++;
+        return;
+    }
+    buffer[used++] = depth - first;
+    for (int i = first; i < depth; i++) {
+        buffer[used++] = (uintptr_t)m->shadowStack[i];
+    }
+}
+
+bool profile_start(VM *vm) {
+    if (profiled_vm != NULL) return false;
+
+    // pages are only touched as samples come in
+    buffer = malloc(PROFILE_BUFFER_FRAMES * sizeof(uintptr_t));
+    if (buffer == NULL) return false;
+    used = 0;
+    dropped = 0;
+    profiled_vm = vm;
+
+    struct sigaction action = {.sa_handler = on_sigprof,
+                               .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &saved_action);
+
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = 0, .tv_usec = 1000000 / PROFILE_HZ},
+        .it_value = {.tv_sec = 0, .tv_usec = 1000000 / PROFILE_HZ},
+    };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    return true;
+}
+
+static int compare_stacks(const void *x, const void *y) {
+    return strcmp(*(char**)x, *(char**)y);
+}
+
+// Folds every sample into "outer;inner;leaf", then counts equal stacks.
+static bool write_folded(char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) return false;
+
+    size_t count = 0;
+    for (size_t i = 0; i < used; i += buffer[i] + 1) { count++; }
+    char **stacks = malloc((count + 1) * sizeof(char*));
+
+    size_t n = 0;
+    for (size_t i = 0; i < used; i += buffer[i] + 1) {
+        size_t depth = buffer[i], len = 1;
+        for (size_t j = 1; j <= depth; j++) {
+            len += strlen((char*)buffer[i + j]) + 1;
+        }
+        char *stack = malloc(len + sizeof("[toplevel]"));
+        strcpy(stack, "[toplevel]");
+        for (size_t j = 1; j <= depth; j++) {
+            strcat(stack, ";");
+            strcat(stack, (char*)buffer[i + j]);
+        }
+        stacks[n++] = stack;
+    }
+    qsort(stacks, n, sizeof(char*), compare_stacks);
+
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && string_eq(stacks[i], stacks[j])) { j++; }
+        fprintf(out, "%s %zu\n", stacks[i], j - i);
+        i = j;
+    }
+    if (dropped)
+        fprintf(stderr, "profile: %lu samples dropped, buffer full\n", dropped);
+
+    for (size_t i = 0; i < n; i++) { free(stacks[i]); }
+    free(stacks);
+    return fclose(out) == 0;
+}
+
+bool profile_stop(VM *vm, char *path) {
+    if (profiled_vm != vm) return false;
+
+    struct itimerval off = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_PROF, &off, NULL);
+    sigaction(SIGPROF, &saved_action, NULL);
+    profiled_vm = NULL;
+
+    bool ok = path == NULL || write_folded(path);
+    free(buffer);
+    buffer = NULL;
+    return ok;
+}
@@ -6,35 +6,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include "lisp.h"
+#include "text.h"
 
 
-int is_space(char x) { return x == ' ' || x == '\n'; }
-int is_parens(char x) { return x == '(' || x == ')'; }
-int is_double_quotes(char x) { return x == '"'; }
+int is_space(int x) { return x == ' ' || x == '\n' || x == '\t' || x == '\r'; }
+int is_parens(int x) { return x == '(' || x == ')'; }
+int is_double_quotes(int x) { return x == '"'; }
+int is_comment(int x) { return x == ';'; }
+// 'x `x ,x ,@x
+int is_prefix(int x) { return x == '\'' || x == '`' || x == ','; }
 
 #define SYMBOL_MAX 32
 #define is_valid_char(look) (look != EOF                    \
                              && !is_space(look)             \
                              && !is_parens(look)            \
-                             && !is_double_quotes(look))
+                             && !is_double_quotes(look)     \
+                             && !is_prefix(look))
 
-static char get_next_char(FILE *input) {
-    char look = getc(input);
-    while(is_space(look)) { look = getc(input); }
+// skips whitespace and ; comments
+static int get_next_char(FILE *input) {
+    int look = getc(input);
+    while (is_space(look) || is_comment(look)) {
+        if (is_comment(look)) {
+            while (look != '\n' && look != EOF) { look = getc(input); }
+        }
+        look = getc(input);
+    }
     return look;
 }
 
+// returns NULL at the end of input
 static char *gettoken(FILE *input) {
     int index = 0;
     char token[SYMBOL_MAX]; /* token */
-    char look = get_next_char(input);
+    int look = get_next_char(input);
 
     if (look == EOF) {
-        exit(1);
+        return NULL;
     }
     else if (is_parens(look) || is_double_quotes(look)) {
         token[index++] = look;
     }
+    else if (is_prefix(look)) {
+        token[index++] = look;
+        if (look == ',') {
+            look = getc(input);
+            if (look == '@')
+                token[index++] = look;
+            else
+                ungetc(look, input);
+        }
+    }
     else {
         while(index < SYMBOL_MAX - 1 && is_valid_char(look)) {
             token[index++] = look;
@@ -67,54 +89,103 @@ LispType getNumType(char *token, LispType t)
 }
 
 Cell *getlist(FILE *input);
+Cell *getprefixed(char *token, FILE *input);
 Cell *getstring(FILE *input);
 Cell *getnumber(LispType t, char *token);
 
-Cell *getobj(FILE *input) {
-    char *token = gettoken(input);
+// the object token begins, the rest of it read from input
+static Cell *gettokenobj(char *token, FILE *input) {
     LispType type = TypeUnknown;
 
     /* debuglog("Getting obj start, %s\n", token); */
-    if (token[0] == '(')
+    if (token == NULL)
+        return NULL;
+    else if (token[0] == '(')
         return getlist(input);
     else if (token[0] == '"')
         return getstring(input);
+    else if (is_prefix(token[0]))
+        return getprefixed(token, input);
     else if ((type = getNumType(token, type)) != TypeUnknown)
         return getnumber(type, token);
     return intern(token);
 }
 
+Cell *getobj(FILE *input) {
+    return gettokenobj(gettoken(input), input);
+}
+
 Cell *getlist(FILE *input) {
 
     /* debuglogln("Getting list start"); */
     // N/A -- check for missing closing paren
     // stdin will hang when list is not balanced.
 
-    char peek = get_next_char(input); 
+    int peek = get_next_char(input); 
     if (peek == ')')
         return nil();
+    else if (peek == EOF)
+        raise_error("unexpected end of input in list%s", "");
     ungetc(peek, input);
-    return cons(getobj(input), getlist(input));
+    // (x . y), a lone dot cannot be a symbol otherwise. The token is
+    // looked at before anything gets interned.
+    char *token = gettoken(input);
+    if (string_eq(token, ".")) {
+        free(token);
+        Cell *tail = getobj(input);
+        if (tail == NULL || get_next_char(input) != ')')
+            raise_error("malformed dotted list%s", "");
+        return tail;
+    }
+    // read the head before the tail, argument evaluation order is unspecified
+    Cell *head = gettokenobj(token, input);
+    Cell *tail = getlist(input);
+    return cons(head, tail);
 }
 
-Cell *getstring(FILE *input) {
+// the form after a prefix, read as (quote x), (quasiquote x), (unquote x)
+// or (unquote-splicing x)
+Cell *getprefixed(char *token, FILE *input) {
+    char *name = token[0] == '\'' ? "quote"
+        : token[0] == '`' ? "quasiquote"
+        : token[1] == '@' ? "unquote-splicing"
+        : "unquote";
+    Cell *obj = getobj(input);
+    if (obj == NULL)
+        raise_error("unexpected end of input after %s", token);
+    return cons(intern(name), cons(obj, nil()));
+}
 
-    char *token = gettoken(input);
-    /* debuglog("Getting list start with content %s\n", token); */
-    Cell *tmp = make_cell(TypeString, token);
-    token = gettoken(input);
-    if (token[0] != '"') {
-        printf("error reading string, missing \"\n");
-        return nil();
+// the characters up to the closing quote, \" \\ \n and \t are escapes
+Cell *getstring(FILE *input) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    int c;
+    while ((c = getc(input)) != '"' && c != EOF) {
+        if (c == '\\') {
+            c = getc(input);
+            c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+            if (c == EOF)
+                break;
+        }
+        fputc(c, out);
     }
-    return tmp;
+    fclose(out);
+    if (c == EOF) {
+        free(text);
+        raise_error("missing \" at the end of a string%s", "");
+    }
+    Cell *string = make_string(text, size);
+    free(text);
+    return string;
 }
 
 Cell *getnumber(LispType type, char *token) {
 
     /* debuglogln("Getting number start"); */
     if (type == TypeInt) {
-        return make_cell(type, (void *)atoi(token));
+        return make_int(atoi(token));
     }
     if (type == TypeFloat) {
         float *f = malloc(sizeof(float));
@@ -123,12 +194,12 @@ Cell *getnumber(LispType type, char *token) {
     }
     return nil();
 }
+// returns NULL at the end of input
 Cell *lisp_read(FILE* input) {
 
     prog1(Cell*, res, getobj(input),
-          debuglog("after, read %d, %d(%d)\n",
-                   getVM()->numObjs, count_obj(res), count_freeable_obj(res)));
-    return getobj(input);
+          if (res)
+              debuglog("after, read %d\n", getVM()->numObjs));
 }
 
 #include <sys/types.h>
@@ -164,51 +235,68 @@ Cell *read_from_string(const char* string) {
     return obj;
 }
 
-void print_expr(Cell *exp) {
+void fprint_expr(FILE *out, Cell *exp) {
     if (null(exp)) {
-        printf("nil");
+        fprintf(out, "nil");
+    }
+    else if (is_string(exp)) {
+        fwrite(string_bytes(exp), 1, string_size(exp), out);
+    }
+    else if (is_symbol(exp) || is_error(exp)) {
+        fprintf(out, "%s", (char *)exp->val);
     }
-    else if (is_symbol(exp) || is_string(exp) || is_error(exp)) {
-        printf("%s", (char *)exp->val);
+    else if (is_builder(exp)) {
+        fprintf(out, "<Builder %p>", (void *)exp);
     }
     // check procedure before list
     else if (is_procedure(exp)) {
-        printf("<Proc %p>", (void *)exp);
+        fprintf(out, "<Proc %p>", (void *)exp);
+    }
+    else if (is_future(exp)) {
+        fprintf(out, "<Future %p>", (void *)exp);
+    }
+    else if (is_promise(exp)) {
+        fprintf(out, "<Promise %p>", (void *)exp);
+    }
+    else if (is_port(exp)) {
+        fprintf(out, "<Port %p>", (void *)exp);
     }
     else if (is_pair(exp)) {
-        printf("(");
+        fprintf(out, "(");
         /* debuglog("print_expr: %s, %d\n", ((Cell*)car(exp))->val, ((Cell*)car(exp))->type); */
-        print_expr(car(exp));
+        fprint_expr(out, car(exp));
         /* debuglog("print_expr: mid %p, %d\n", (exp)->next, exp->type); */
         Cell *e = cdr(exp);
         /* debuglog("print_expr: after %d, %d\n", e->next == NULL, e->type); */
-        if (!null(e) && is_atom(e)) {
-            // print cons
-            printf(" . ");
-            print_expr(e);
-            printf(")");
-        } else {
-            // print normal list
-            for (; e && !null(e); e = cdr(e)) {
-                printf(" ");
-                /* printf("SPACE %s %d", ((Cell*)e)->val, ((Cell*)e)->type); */
-                print_expr(car(e));
-            }
-            printf(")");
+        // print normal list
+        for (; e && is_pair(e); e = cdr(e)) {
+            fprintf(out, " ");
+            /* printf("SPACE %s %d", ((Cell*)e)->val, ((Cell*)e)->type); */
+            fprint_expr(out, car(e));
+        }
+        if (e && !null(e)) {
+            // print the cons at the end of an improper list
+            fprintf(out, " . ");
+            fprint_expr(out, e);
         }
+        fprintf(out, ")");
     }
     else if (is_integer(exp)) {
-        printf("%d", (int)exp->val);
+        fprintf(out, "%d", int_val(exp));
     }
     else if (is_float(exp)) {
-        printf("%f", *(float *)exp->val);
+        fprintf(out, "%f", *(float *)exp->val);
     }
     else if (is_primitive(exp)) {
-        printf("<Prim %s %p>", prim_name(exp), (void*)exp);
+        fprintf(out, "<Prim %s %p>", prim_name(exp), (void*)exp);
     }
     else {
         // should not reach this stage
-        printf("<%s: unsupported exp type=%d>", __func__, exp->type);
+        fprintf(out, "<%s: unsupported exp type=%d>", __func__, exp->type);
     }
 }
 
+
+void print_expr(Cell *exp) {
+    fprint_expr(stdout, exp);
+}
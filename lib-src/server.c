@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+#include "condition.h"
+#include "lisp.h"
+#include "reader.h"
+
+typedef struct {
+    int fd;
+    // bytes read that do not make a whole frame yet
+    unsigned char *in;
+    size_t inSize;
+    size_t inCapacity;
+    // responses, written from outStart
+    unsigned char *out;
+    size_t outStart;
+    size_t outSize;
+    size_t outCapacity;
+    // the epoll events asked for
+    uint32_t events;
+    // the client is done sending, it is closed once answered
+    bool eof;
+} Connection;
+
+typedef struct {
+    VM *vm;
+    ServerLimits limits;
+    int epoll;
+    int listener;
+} Server;
+
+// what the signal handlers act on
+static VM *serving_vm = NULL;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_timeout(int sig) {
+    if (serving_vm != NULL)
+        lisp_interrupt(serving_vm, INTERRUPT_TIMEOUT);
+}
+
+static void on_stop(int sig) {
+    stop_requested = 1;
+}
+
+static void set_timer(long ms) {
+    struct itimerval timer = {
+        .it_value = {.tv_sec = ms / 1000, .tv_usec = ms % 1000 * 1000}};
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+static void reserve(unsigned char **buf, size_t *capacity, size_t size) {
+    if (size <= *capacity)
+        return;
+    while (*capacity < size) {
+        *capacity = *capacity ? 2 * *capacity : 4096;
+    }
+    *buf = realloc(*buf, *capacity);
+}
+
+static void respond(Connection *c, char status, char *text, size_t size) {
+    size_t n = FRAME_HEADER_SIZE + 1 + size;
+    reserve(&c->out, &c->outCapacity, c->outSize + n);
+    unsigned char *frame = c->out + c->outSize;
+    frame_put_length(frame, 1 + size);
+    frame[FRAME_HEADER_SIZE] = status;
+    memcpy(frame + FRAME_HEADER_SIZE + 1, text, size);
+    c->outSize += n;
+}
+
+// The forms of src one after the other, within the limits, the value of
+// the last one or the first error is the response.
+static void evaluate(Server *s, Connection *c, unsigned char *src,
+                     size_t size) {
+    VM *vm = s->vm;
+    Cell *result = nil();
+    bool raised = false;
+    // fmemopen refuses an empty buffer
+    FILE *input = size > 0 ? fmemopen(src, size, "r") : NULL;
+    if (input != NULL) {
+        if (s->limits.timeout > 0)
+            set_timer(s->limits.timeout);
+        if (s->limits.allocMax > 0)
+            vm->tlabLimit = __atomic_load_n(&vm->tlabs, __ATOMIC_RELAXED)
+                + (s->limits.allocMax + TLAB_SIZE - 1) / TLAB_SIZE;
+        Cell *exp;
+        while (!raised && (exp = lisp_read_form(vm, input)) != NULL) {
+            raised = is_error(exp);
+            result = raised ? exp : lisp_eval(vm, exp, &raised);
+        }
+        set_timer(0);
+        vm->tlabLimit = 0;
+        lisp_interrupt(vm, 0);
+        fclose(input);
+    }
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    fprint_expr(out, result);
+    fclose(out);
+    respond(c, raised ? FRAME_ERROR : FRAME_OK, text, length);
+    free(text);
+}
+
+// Evaluates the whole frames read while the client keeps up with the
+// responses. False on a protocol error.
+static bool evaluate_frames(Server *s, Connection *c) {
+    size_t start = 0;
+    while (c->inSize - start >= FRAME_HEADER_SIZE
+           && c->outSize - c->outStart < SERVER_BACKLOG_MAX) {
+        uint32_t n = frame_length(c->in + start);
+        if (n > FRAME_MAX)
+            return false;
+        if (c->inSize - start < FRAME_HEADER_SIZE + n)
+            break;
+        evaluate(s, c, c->in + start + FRAME_HEADER_SIZE, n);
+        start += FRAME_HEADER_SIZE + n;
+    }
+    memmove(c->in, c->in + start, c->inSize - start);
+    c->inSize -= start;
+    return true;
+}
+
+static bool read_available(Connection *c) {
+    while (!c->eof) {
+        reserve(&c->in, &c->inCapacity, c->inSize + 4096);
+        ssize_t n = read(c->fd, c->in + c->inSize, c->inCapacity - c->inSize);
+        if (n > 0) {
+            c->inSize += n;
+        }
+        else if (n == 0) {
+            c->eof = true;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        else if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool flush(Connection *c) {
+    while (c->outStart < c->outSize) {
+        ssize_t n = send(c->fd, c->out + c->outStart, c->outSize - c->outStart,
+                         MSG_NOSIGNAL);
+        if (n >= 0) {
+            c->outStart += n;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        else if (errno != EINTR) {
+            return false;
+        }
+    }
+    c->outStart = c->outSize = 0;
+    return true;
+}
+
+static void close_connection(Server *s, Connection *c) {
+    epoll_ctl(s->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+// Reads what came in, answers it and waits for what it can do next.
+static void serve_connection(Server *s, Connection *c, uint32_t events) {
+    bool ok = true;
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        ok = read_available(c);
+    // evaluating may free room to evaluate more, once it is flushed
+    while (ok) {
+        size_t pending = c->inSize;
+        ok = evaluate_frames(s, c) && flush(c);
+        if (c->inSize == pending || c->outStart < c->outSize)
+            break;
+    }
+    bool backlog = c->outStart < c->outSize;
+    if (!ok || (c->eof && !backlog)) {
+        close_connection(s, c);
+        return;
+    }
+    uint32_t wanted = (backlog ? EPOLLOUT : 0)
+        | (c->eof || c->outSize - c->outStart >= SERVER_BACKLOG_MAX
+           ? 0 : EPOLLIN);
+    if (wanted != c->events) {
+        struct epoll_event event = {.events = wanted, .data.ptr = c};
+        epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &event);
+        c->events = wanted;
+    }
+}
+
+static void accept_connections(Server *s) {
+    int fd;
+    while ((fd = accept4(s->listener, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Connection *c = calloc(1, sizeof(Connection));
+        c->fd = fd;
+        c->events = EPOLLIN;
+        struct epoll_event event = {.events = c->events, .data.ptr = c};
+        if (epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            perror("epoll_ctl");
+            close(fd);
+            free(c);
+        }
+    }
+}
+
+static int listen_on(char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long, %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(fd, SOMAXCONN) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int lisp_serve(VM *vm, char *path, ServerLimits limits) {
+    Server s = {.vm = vm, .limits = limits};
+    s.listener = listen_on(path);
+    if (s.listener < 0)
+        return 1;
+    s.epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (s.epoll < 0 || epoll_ctl(s.epoll, EPOLL_CTL_ADD, s.listener, &event)) {
+        perror("epoll");
+        close(s.listener);
+        return 1;
+    }
+
+    serving_vm = vm;
+    struct sigaction timeout = {.sa_handler = on_timeout,
+                                .sa_flags = SA_RESTART};
+    sigaction(SIGALRM, &timeout, NULL);
+    // without SA_RESTART, so that epoll_wait returns
+    struct sigaction stop = {.sa_handler = on_stop};
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    struct epoll_event events[SERVER_EVENTS_MAX];
+    while (!stop_requested) {
+        int n = epoll_wait(s.epoll, events, SERVER_EVENTS_MAX, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_connections(&s);
+            else
+                serve_connection(&s, events[i].data.ptr, events[i].events);
+        }
+    }
+
+    serving_vm = NULL;
+    close(s.epoll);
+    close(s.listener);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <time.h>
+#include "stats.h"
+
+Stats *stats_new(void) {
+    return calloc(1, sizeof(Stats));
+}
+
+void stats_free(Stats *stats) {
+    if (stats == NULL) return;
+    free(stats->calls);
+    free(stats->sites);
+    free(stats);
+}
+
+// seconds, monotonic
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_record_gc(VM *vm, double start) {
+    Stats *stats = vm->stats;
+    double pause = stats_now() - start;
+    stats->gcCycles++;
+    stats->gcPauseTotal += pause;
+    if (pause > stats->gcPauseMax)
+        stats->gcPauseMax = pause;
+
+    int bucket = 0;
+    for (double us = pause * 1e6; us >= 1 && bucket < GC_PAUSE_BUCKETS - 1;
+         us /= 2) {
+        bucket++;
+    }
+    stats->gcPauses[bucket]++;
+}
+
+#define hash_name(name, mask) (((uintptr_t)(name) >> 3) & (mask))
+
+static void grow_calls(Stats *stats) {
+    CallCount *old = stats->calls;
+    size_t oldCapacity = stats->callsCapacity;
+    stats->callsCapacity = oldCapacity ? 2 * oldCapacity : 64;
+    stats->calls = calloc(stats->callsCapacity, sizeof(CallCount));
+    size_t mask = stats->callsCapacity - 1;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].name == NULL) continue;
+        size_t j = hash_name(old[i].name, mask);
+        while (stats->calls[j].name) { j = (j + 1) & mask; }
+        stats->calls[j] = old[i];
+    }
+    free(old);
+}
+
+void stats_count_call(Stats *stats, char *name) {
+    if (2 * (stats->callsSize + 1) > stats->callsCapacity)
+        grow_calls(stats);
+    size_t mask = stats->callsCapacity - 1;
+    size_t i = hash_name(name, mask);
+    while (stats->calls[i].name && stats->calls[i].name != name) {
+        i = (i + 1) & mask;
+    }
+    if (stats->calls[i].name == NULL) {
+        stats->calls[i].name = name;
+        stats->callsSize++;
+    }
+    stats->calls[i].count++;
+}
+
+#define hash_site(name, caller, mask)                                    \
+    ((((uintptr_t)(name) ^ (uintptr_t)(caller)) >> 3) & (mask))
+
+static void grow_sites(Stats *stats) {
+    AllocSite *old = stats->sites;
+    size_t oldCapacity = stats->sitesCapacity;
+    stats->sitesCapacity = oldCapacity ? 2 * oldCapacity : 64;
+    stats->sites = calloc(stats->sitesCapacity, sizeof(AllocSite));
+    size_t mask = stats->sitesCapacity - 1;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].count == 0) continue;
+        size_t j = hash_site(old[i].name, old[i].caller, mask);
+        while (stats->sites[j].count) { j = (j + 1) & mask; }
+        stats->sites[j] = old[i];
+    }
+    free(old);
+}
+
+void stats_sample_alloc(Mutator *m, void *caller) {
+    Stats *stats = m->stats;
+    stats->sampleCountdown = ALLOC_SAMPLE_PERIOD;
+
+    // Lisp code is attributed by procedure, the C caller is only kept
+    // for allocations outside of any (recorded) application
+    int depth = m->shadowDepth;
+    const char *name = NULL;
+    if (depth > 0 && depth <= SHADOW_STACK_MAX) {
+        name = m->shadowStack[depth - 1];
+        caller = NULL;
+    }
+
+    if (2 * (stats->sitesSize + 1) > stats->sitesCapacity)
+        grow_sites(stats);
+    size_t mask = stats->sitesCapacity - 1;
+    size_t i = hash_site(name, caller, mask);
+    while (stats->sites[i].count
+           && (stats->sites[i].name != name
+               || stats->sites[i].caller != caller)) {
+        i = (i + 1) & mask;
+    }
+    if (stats->sites[i].count == 0) {
+        stats->sites[i].name = name;
+        stats->sites[i].caller = caller;
+        stats->sitesSize++;
+    }
+    stats->sites[i].count++;
+}
+
+const char *stats_site_name(const AllocSite *site) {
+    if (site->name) return site->name;
+    Dl_info info;
+    if (dladdr(site->caller, &info) && info.dli_sname)
+        return info.dli_sname;
+    return "[unknown]";
+}
+
+static void update_peak(VM *vm) {
+    size_t used = vm->next - vm->heap;
+    if (used > vm->stats->peakHeap)
+        vm->stats->peakHeap = used;
+}
+
+const Stats *lisp_stats(VM *vm) {
+    if (vm->stats == NULL) return NULL;
+    update_peak(vm);
+    return vm->stats;
+}
+
+// upper bound of a pause bucket in microseconds, 0 for the last one
+#define bucket_limit(i) ((i) == GC_PAUSE_BUCKETS - 1 ? 0 : 1UL << (i))
+
+// name as a JSON string, symbols may hold any character
+static void json_string(FILE *out, const char *name) {
+    putc('"', out);
+    for (const unsigned char *c = (const unsigned char*)name; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(out, "\\u%04x", *c);
+        else
+            putc(*c, out);
+    }
+    putc('"', out);
+}
+
+void stats_dump_json(VM *vm, FILE *out) {
+    const Stats *stats = lisp_stats(vm);
+    if (stats == NULL) {
+        fprintf(out, "{}\n");
+        return;
+    }
+    fprintf(out, "{\n  \"allocations\": {");
+    for (int t = 0; t < TypeCount; t++) {
+        fprintf(out, "%s\"%s\": %lu", t ? ", " : "", type_name(t),
+                stats->allocs[t]);
+    }
+    fprintf(out, "},\n  \"gc\": {\"cycles\": %lu, \"pause_total_us\": %.1f,"
+            " \"pause_max_us\": %.1f, \"pause_histogram_us\": {",
+            stats->gcCycles, stats->gcPauseTotal * 1e6,
+            stats->gcPauseMax * 1e6);
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (bucket_limit(i))
+            fprintf(out, "%s\"<%lu\": %lu", i ? ", " : "", bucket_limit(i),
+                    stats->gcPauses[i]);
+        else
+            fprintf(out, ", \"more\": %lu", stats->gcPauses[i]);
+    }
+    fprintf(out, "}},\n  \"heap\": {\"cells\": %ld, \"peak_cells\": %zu,"
+            " \"cell_bytes\": %zu},\n  \"call_cache\": {\"hits\": %lu,"
+            " \"misses\": %lu},\n  \"calls\": {",
+            (long)(vm->next - vm->heap), stats->peakHeap, sizeof(Cell),
+            stats->callCacheHits, stats->callCacheMisses);
+    bool first = true;
+    for (size_t i = 0; i < stats->callsCapacity; i++) {
+        if (stats->calls[i].name == NULL) continue;
+        fprintf(out, "%s", first ? "" : ", ");
+        json_string(out, stats->calls[i].name);
+        fprintf(out, ": %lu", stats->calls[i].count);
+        first = false;
+    }
+    fprintf(out, "}\n}\n");
+}
+
+#define make_entry(name, val) cons(intern(name), val)
+
+Cell *stats_to_list(VM *vm) {
+    const Stats *stats = lisp_stats(vm);
+    if (stats == NULL) return nil();
+    long used = vm->next - vm->heap;
+
+    Cell *allocs = nil();
+    for (int t = TypeCount - 1; t >= 0; t--) {
+        if (stats->allocs[t])
+            allocs = cons(make_entry(type_name(t),
+                                     make_total(stats->allocs[t])), allocs);
+    }
+    Cell *pauses = nil();
+    for (int i = GC_PAUSE_BUCKETS - 1; i >= 0; i--) {
+        pauses = cons(cons(make_int(bucket_limit(i)),
+                           make_total(stats->gcPauses[i])), pauses);
+    }
+    Cell *calls = nil();
+    for (size_t i = 0; i < stats->callsCapacity; i++) {
+        if (stats->calls[i].name)
+            calls = cons(make_entry(stats->calls[i].name,
+                                    make_total(stats->calls[i].count)),
+                         calls);
+    }
+    return make_cCell(9,
+                      make_entry("allocations", allocs),
+                      make_entry("gc-cycles", make_total(stats->gcCycles)),
+                      make_entry("gc-pause-total-us",
+                                 make_total(stats->gcPauseTotal * 1e6)),
+                      make_entry("gc-pause-histogram-us", pauses),
+                      make_entry("heap-cells", make_total(used)),
+                      make_entry("peak-heap-cells",
+                                 make_total(stats->peakHeap)),
+                      make_entry("call-cache-hits",
+                                 make_total(stats->callCacheHits)),
+                      make_entry("call-cache-misses",
+                                 make_total(stats->callCacheMisses)),
+                      make_entry("calls", calls));
+}
@@ -0,0 +1,163 @@
+#include <sched.h>
+#include <sys/types.h>
+#include "stream.h"
+#include "condition.h"
+#include "lisp.h"
+#include "reader.h"
+#include "text.h"
+
+// the primitive the rest of a stream is a promise of applying
+#define primitive(name) make_cell(TypePrim, (void*)lookup_prim(name))
+
+Cell *make_promise(Cell *fn, Cell *args) {
+    Cell *promise = make_cell(TypePromise, NULL);
+    promise->flags = PROMISE_DELAYED;
+    promise->next = cons(fn, args);
+    return promise;
+}
+
+// Forced again while it is being forced, by itself or another thread, a
+// promise keeps the value stored first. Its procedure and arguments are
+// let go of then. A raise leaves it delayed.
+Cell *force(Cell *x) {
+    if (!is_promise(x))
+        return x;
+    Cell *thunk = __atomic_load_n(&x->next, __ATOMIC_ACQUIRE);
+    if (thunk == NULL)
+        return x->val;
+    Cell *value = apply(car(thunk), cdr(thunk));
+    unsigned int delayed = PROMISE_DELAYED;
+    if (__atomic_compare_exchange_n(&x->flags, &delayed, PROMISE_STORING,
+                                    false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_ACQUIRE)) {
+        x->val = value;
+        __atomic_store_n(&x->flags, PROMISE_DONE, __ATOMIC_RELEASE);
+        __atomic_store_n(&x->next, NULL, __ATOMIC_RELEASE);
+    }
+    while (__atomic_load_n(&x->flags, __ATOMIC_ACQUIRE) != PROMISE_DONE) {
+        sched_yield();
+    }
+    return x->val;
+}
+
+// the forced stream s, nil or a pair
+static Cell *stream(Cell *s) {
+    s = force(s);
+    if (!null(s))
+        ensure(s, TypePair);
+    return s;
+}
+
+#define apply1(fn, x) apply_argv(fn, 1, (Cell*[]){x})
+
+Cell *stream_map(Cell *fn, Cell *s) {
+    s = stream(s);
+    if (null(s))
+        return nil();
+    Cell *x = apply1(fn, car(s));
+    Cell *rest = cons(fn, cons(cdr(s), nil()));
+    return cons(x, make_promise(primitive("stream-map"), rest));
+}
+
+Cell *stream_filter(Cell *pred, Cell *s) {
+    for (s = stream(s); !null(s); s = stream(cdr(s))) {
+        if (!null(apply1(pred, car(s)))) {
+            Cell *rest = cons(pred, cons(cdr(s), nil()));
+            return cons(car(s), make_promise(primitive("stream-filter"), rest));
+        }
+    }
+    return nil();
+}
+
+Cell *stream_take(long n, Cell *s) {
+    if (n <= 0)
+        return nil();
+    s = stream(s);
+    if (null(s))
+        return nil();
+    Cell *rest = cons(make_int(n - 1), cons(cdr(s), nil()));
+    return cons(car(s), make_promise(primitive("stream-take"), rest));
+}
+
+// The state of the fold is on the thread's stack, the only cells from
+// after young the C frames hold between two steps. The VM's own thread
+// collects them every STREAM_GC_CELLS cells, as well as the live ones
+// from after young. A step that collected all of them, see gc_eval, may
+// have moved cells across young, the fold starts over from there.
+//
+// Nothing else on the C stack refers to the stream: its first cells would
+// be taken for in use by gc_eval, and with them all those forced since.
+Cell *stream_fold(Cell **state, long young) {
+    VM *vm = getVM();
+    Mutator *m = getMutator();
+    int base = state - m->stack;
+    unsigned long collections = vm->evalCollections;
+    state[2] = stream(state[2]);
+    long limit = young + STREAM_GC_CELLS;
+    while (!null(state[2])) {
+        interrupt_poll(vm, m);
+        state[1] = apply_argv(state[0], 2, (Cell*[]){state[1], car(state[2])});
+        state[2] = stream(cdr(state[2]));
+        if (vm->evalCollections != collections) {
+            // what it allocates in the holes stays until the next one
+            collections = vm->evalCollections;
+            young = vm->next - vm->heap;
+            limit = young + STREAM_GC_CELLS;
+        }
+        long next = __atomic_load_n(&vm->next, __ATOMIC_RELAXED) - vm->heap;
+        if (next >= limit && m == &vm->main && !vm_parallel(vm)) {
+            gc_young(vm, young);
+            next = vm->next - vm->heap;
+            limit = next + STREAM_GC_CELLS + (next - young);
+        }
+    }
+    Cell *result = state[1];
+    m->stackSize = base;
+    return result;
+}
+
+//
+
+Cell *open_port(char *path) {
+    FILE *input = fopen(path, "r");
+    if (input == NULL)
+        raise_error("cannot open %s", path);
+    return make_cell(TypePort, input);
+}
+
+void close_port(Cell *port) {
+    ensure(port, TypePort);
+    if (port->val)
+        fclose(port->val);
+    port->val = NULL;
+}
+
+// the next line without its newline, NULL at the end
+static Cell *read_line(FILE *input) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t size = getline(&line, &capacity, input);
+    Cell *x = NULL;
+    if (size >= 0) {
+        if (size > 0 && line[size - 1] == '\n')
+            size--;
+        x = make_string(line, size);
+    }
+    free(line);
+    return x;
+}
+
+// Each element is read when the promise of it is forced. Forcing the
+// same one from several futures at a time would read it twice.
+Cell *port_stream(Cell *port, bool lines) {
+    ensure(port, TypePort);
+    if (port->val == NULL)
+        return nil();
+    Cell *x = lines ? read_line(port->val) : lisp_read(port->val);
+    if (x == NULL) {
+        close_port(port);
+        return nil();
+    }
+    Cell *rest = cons(port, lines ? cons(intern("lines"), nil()) : nil());
+    return cons(x, make_promise(primitive("port-stream"), rest));
+}
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "text.h"
+#include "reader.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TEXT_SIMD
+#endif
+
+typedef struct {
+    const char *name;
+    // bytes that start a character
+    size_t (*count_chars)(const char *p, size_t n);
+    bool (*equal)(const char *a, const char *b, size_t n);
+    // offset of the first c or needle in p, -1 when there is none
+    long (*find_byte)(const char *p, size_t n, char c);
+    long (*find)(const char *p, size_t n, const char *needle, size_t m);
+} Kernels;
+
+#define is_continuation(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+static size_t count_chars_scalar(const char *p, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += !is_continuation(p[i]);
+    }
+    return count;
+}
+
+static bool equal_scalar(const char *a, const char *b, size_t n) {
+    return memcmp(a, b, n) == 0;
+}
+
+static long find_byte_scalar(const char *p, size_t n, char c) {
+    const char *found = memchr(p, c, n);
+    return found ? found - p : -1;
+}
+
+static long find_scalar(const char *p, size_t n, const char *needle,
+                        size_t m) {
+    const char *found = memmem(p, n, needle, m);
+    return found ? found - p : -1;
+}
+
+#ifdef TEXT_SIMD
+
+// Bytes above -65 as signed, 0xBF, are not continuation bytes. A needle
+// is looked for where both its first and its last byte match, a block at
+// a time, and only those places are compared in full.
+#define def_kernels(isa, target, vec, width, load, set1, cmpeq, cmpgt,    \
+                    and, movemask, all)                                  \
+    target static size_t count_chars_##isa(const char *p, size_t n) {     \
+        size_t count = 0, i = 0;                                         \
+        vec limit = set1(-65);                                           \
+        for (; i + width <= n; i += width) {                             \
+            vec v = load((const vec *)(p + i));                          \
+            unsigned starts = movemask(cmpgt(v, limit));                 \
+            count += __builtin_popcount(starts);                         \
+        }                                                                \
+        return count + count_chars_scalar(p + i, n - i);                 \
+    }                                                                    \
+                                                                         \
+    target static bool equal_##isa(const char *a, const char *b,         \
+                                   size_t n) {                           \
+        size_t i = 0;                                                    \
+        for (; i + width <= n; i += width) {                             \
+            vec x = load((const vec *)(a + i));                          \
+            vec y = load((const vec *)(b + i));                          \
+            if ((unsigned)movemask(cmpeq(x, y)) != all)                  \
+                return false;                                            \
+        }                                                                \
+        return memcmp(a + i, b + i, n - i) == 0;                         \
+    }                                                                    \
+                                                                         \
+    target static long find_byte_##isa(const char *p, size_t n, char c) { \
+        size_t i = 0;                                                    \
+        vec wanted = set1(c);                                            \
+        for (; i + width <= n; i += width) {                             \
+            unsigned mask = movemask(cmpeq(load((const vec *)(p + i)),   \
+                                           wanted));                     \
+            if (mask != 0)                                               \
+                return i + __builtin_ctz(mask);                          \
+        }                                                                \
+        long found = find_byte_scalar(p + i, n - i, c);                  \
+        return found < 0 ? -1 : (long)i + found;                         \
+    }                                                                    \
+                                                                         \
+    target static long find_##isa(const char *p, size_t n,               \
+                                  const char *needle, size_t m) {        \
+        if (m == 0)                                                      \
+            return 0;                                                    \
+        if (m == 1)                                                      \
+            return find_byte_##isa(p, n, needle[0]);                     \
+        if (m > n)                                                       \
+            return -1;                                                   \
+        vec first = set1(needle[0]);                                     \
+        vec last = set1(needle[m - 1]);                                  \
+        size_t i = 0;                                                    \
+        for (; i + m - 1 + width <= n; i += width) {                     \
+            vec starts = cmpeq(first, load((const vec *)(p + i)));       \
+            vec ends = cmpeq(last, load((const vec *)(p + i + m - 1)));  \
+            unsigned mask = movemask(and(starts, ends));                 \
+            while (mask != 0) {                                          \
+                int bit = __builtin_ctz(mask);                           \
+                if (memcmp(p + i + bit + 1, needle + 1, m - 2) == 0)     \
+                    return i + bit;                                      \
+                mask &= mask - 1;                                        \
+            }                                                            \
+        }                                                                \
+        long found = find_scalar(p + i, n - i, needle, m);               \
+        return found < 0 ? -1 : (long)i + found;                         \
+    }
+
+def_kernels(avx2, __attribute__((target("avx2"))), __m256i, 32,
+            _mm256_loadu_si256, _mm256_set1_epi8, _mm256_cmpeq_epi8,
+            _mm256_cmpgt_epi8, _mm256_and_si256, _mm256_movemask_epi8,
+            0xFFFFFFFFu)
+def_kernels(sse2, , __m128i, 16,
+            _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8,
+            _mm_cmpgt_epi8, _mm_and_si128, _mm_movemask_epi8,
+            0xFFFFu)
+
+#endif
+
+static const Kernels kernel_sets[] = {
+#ifdef TEXT_SIMD
+    {"avx2", count_chars_avx2, equal_avx2, find_byte_avx2, find_avx2},
+    {"sse2", count_chars_sse2, equal_sse2, find_byte_sse2, find_sse2},
+#endif
+    {"scalar", count_chars_scalar, equal_scalar, find_byte_scalar,
+     find_scalar},
+};
+
+#define KERNEL_SETS (sizeof(kernel_sets) / sizeof(kernel_sets[0]))
+
+static const Kernels *kernels = &kernel_sets[KERNEL_SETS - 1];
+
+static bool supported(const Kernels *k) {
+#ifdef TEXT_SIMD
+    if (string_eq(k->name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+#endif
+    return true;
+}
+
+// the first set the CPU has, in the order of kernel_sets
+__attribute__((constructor))
+static void pick_kernels(void) {
+#ifdef TEXT_SIMD
+    __builtin_cpu_init();
+#endif
+    char *wanted = getenv("LISP_TEXT_KERNELS");
+    for (size_t i = 0; i < KERNEL_SETS; i++) {
+        const Kernels *k = &kernel_sets[i];
+        if (supported(k) && (wanted == NULL || string_eq(wanted, k->name))) {
+            kernels = k;
+            return;
+        }
+    }
+}
+
+//
+
+static StrBuf *strbuf_new(size_t capacity) {
+    StrBuf *buf = malloc(sizeof(StrBuf) + capacity);
+    buf->refs = 1;
+    buf->size = 0;
+    buf->capacity = capacity;
+    return buf;
+}
+
+static void strbuf_release(StrBuf *buf) {
+    if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(buf);
+}
+
+static String *slice_new(StrBuf *buf, const char *bytes, size_t size,
+                         size_t length) {
+    String *s = malloc(sizeof(String));
+    __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+    s->buf = buf;
+    s->bytes = bytes;
+    s->size = size;
+    s->length = length;
+    return s;
+}
+
+String *string_new(const char *bytes, size_t size) {
+    StrBuf *buf = strbuf_new(size);
+    memcpy(buf->bytes, bytes, size);
+    buf->size = size;
+    String *s = slice_new(buf, buf->bytes, size,
+                          kernels->count_chars(bytes, size));
+    strbuf_release(buf);
+    return s;
+}
+
+Cell *make_string(const char *bytes, size_t size) {
+    return make_cell(TypeString, string_new(bytes, size));
+}
+
+static Cell *make_slice(String *s, const char *bytes, size_t size,
+                        size_t length) {
+    return make_cell(TypeString, slice_new(s->buf, bytes, size, length));
+}
+
+void string_free(String *s) {
+    strbuf_release(s->buf);
+    free(s);
+}
+
+bool string_equal(Cell *x, Cell *y) {
+    String *a = string_of(x), *b = string_of(y);
+    return a->size == b->size && kernels->equal(a->bytes, b->bytes, a->size);
+}
+
+size_t string_length(Cell *x) {
+    return string_of(x)->length;
+}
+
+// the byte offset of character index in s
+static size_t byte_offset(String *s, size_t index) {
+    if (s->length == s->size)
+        return index;
+    size_t i = 0;
+    // whole blocks of characters before index
+    for (; i + 64 <= s->size; i += 64) {
+        size_t n = kernels->count_chars(s->bytes + i, 64);
+        if (n > index)
+            break;
+        index -= n;
+    }
+    for (; i < s->size; i++) {
+        if (!is_continuation(s->bytes[i]) && index-- == 0)
+            break;
+    }
+    return i;
+}
+
+static size_t char_index(String *s, size_t offset) {
+    return s->length == s->size
+        ? offset : kernels->count_chars(s->bytes, offset);
+}
+
+Cell *substring(Cell *x, long start, long end) {
+    String *s = string_of(x);
+    if (start < 0 || end < start || (size_t)end > s->length)
+        raise_error("no characters %ld to %ld in a string of %zu", start,
+                    end, s->length);
+    size_t from = byte_offset(s, start);
+    size_t to = byte_offset(s, end);
+    return make_slice(s, s->bytes + from, to - from, end - start);
+}
+
+Cell *string_append(int argc, Cell **argv) {
+    size_t size = 0, length = 0;
+    for (int i = 0; i < argc; i++) {
+        ensure(argv[i], TypeString);
+        size += string_size(argv[i]);
+        length += string_length(argv[i]);
+    }
+    StrBuf *buf = strbuf_new(size);
+    for (int i = 0; i < argc; i++) {
+        memcpy(buf->bytes + buf->size, string_bytes(argv[i]),
+               string_size(argv[i]));
+        buf->size += string_size(argv[i]);
+    }
+    Cell *result = make_cell(TypeString,
+                             slice_new(buf, buf->bytes, size, length));
+    strbuf_release(buf);
+    return result;
+}
+
+Cell *string_search(Cell *x, Cell *pattern, long start) {
+    String *s = string_of(x), *p = string_of(pattern);
+    if (start < 0 || (size_t)start > s->length)
+        raise_error("no character %ld in a string of %zu", start, s->length);
+    size_t from = byte_offset(s, start);
+    long found = kernels->find(s->bytes + from, s->size - from, p->bytes,
+                               p->size);
+    return found < 0 ? nil() : make_int(char_index(s, from + found));
+}
+
+Cell *string_split(Cell *x, Cell *separator) {
+    String *s = string_of(x), *sep = string_of(separator);
+    if (sep->size == 0)
+        raise_error("empty separator%s", "");
+    bool ascii = s->length == s->size;
+    Cell *parts = nil();
+    Cell *last = NULL;
+    size_t from = 0;
+    while (true) {
+        long found = kernels->find(s->bytes + from, s->size - from,
+                                   sep->bytes, sep->size);
+        size_t size = found < 0 ? s->size - from : (size_t)found;
+        const char *bytes = s->bytes + from;
+        size_t length = ascii ? size : kernels->count_chars(bytes, size);
+        Cell *part = cons(make_slice(s, bytes, size, length), nil());
+        if (last == NULL)
+            parts = part;
+        else
+            cdr(last) = part;
+        last = part;
+        if (found < 0)
+            return parts;
+        from += size + sep->size;
+    }
+}
+
+//
+
+Builder *builder_new(const char *bytes, size_t size) {
+    Builder *b = malloc(sizeof(Builder));
+    b->buf = strbuf_new(size > 64 ? size : 64);
+    if (size > 0)
+        memcpy(b->buf->bytes, bytes, size);
+    b->buf->size = size;
+    b->length = kernels->count_chars(bytes, size);
+    return b;
+}
+
+Cell *make_builder(void) {
+    return make_cell(TypeBuilder, builder_new(NULL, 0));
+}
+
+void builder_free(Builder *b) {
+    strbuf_release(b->buf);
+    free(b);
+}
+
+// The bytes past size are only ever written by the builder, the strings
+// made from the buffer so far end before them.
+static void builder_write(Builder *b, const char *bytes, size_t size,
+                          size_t length) {
+    StrBuf *buf = b->buf;
+    if (buf->size + size > buf->capacity) {
+        size_t capacity = 2 * buf->capacity;
+        while (capacity < buf->size + size) { capacity *= 2; }
+        StrBuf *grown = strbuf_new(capacity);
+        memcpy(grown->bytes, buf->bytes, buf->size);
+        grown->size = buf->size;
+        strbuf_release(buf);
+        b->buf = buf = grown;
+    }
+    memcpy(buf->bytes + buf->size, bytes, size);
+    buf->size += size;
+    b->length += length;
+}
+
+Cell *builder_add(Cell *builder, Cell *x) {
+    ensure(builder, TypeBuilder);
+    Builder *b = builder->val;
+    if (is_string(x)) {
+        builder_write(b, string_bytes(x), string_size(x), string_length(x));
+        return builder;
+    }
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    fprint_expr(out, x);
+    fclose(out);
+    builder_write(b, text, size, kernels->count_chars(text, size));
+    free(text);
+    return builder;
+}
+
+Cell *builder_string(Cell *builder) {
+    ensure(builder, TypeBuilder);
+    Builder *b = builder->val;
+    return make_cell(TypeString, slice_new(b->buf, b->buf->bytes,
+                                           b->buf->size, b->length));
+}
@@ -1,27 +1,204 @@
 
 
 #include <stdio.h>
+#include <unistd.h>
 
 #include "lisp.h"
 #include "reader.h"
+#include "stats.h"
+#include "profile.h"
+#include "census.h"
+#include "server.h"
+#include "text.h"
 
-int main() {
-    Cell *env = init_environment();
+static void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [--image path] [--repl] [--trace] [--optimize]"
+            " [--stats path] [--profile path]\n"
+            "       [--serve socket [--timeout ms] [--max-alloc cells]]"
+            " [file | -] [args...]\n"
+            "  without a file the script is read from stdin,\n"
+            "  --repl (or a terminal on stdin) starts the interactive loop,\n"
+            "    once the file, if any, is loaded,\n"
+            "  --serve answers requests on a Unix domain socket once the\n"
+            "    file, if any, is loaded, each within --timeout (%d ms) and\n"
+            "    --max-alloc (%d cells), 0 for no limit\n"
+            "  --trace prints every evaluation step on stderr,\n"
+            "  --optimize optimizes procedures as they are made,\n"
+            "  --stats writes runtime statistics as JSON at exit,\n"
+            "  --profile samples the whole run into folded stacks,\n"
+            "  SIGUSR1 prints a heap census on stderr\n",
+            prog, SERVER_TIMEOUT, SERVER_ALLOC_MAX);
+}
 
+// a script may start with #!/path/to/lisp.out
+static void skip_shebang(FILE *input) {
+    int c = getc(input);
+    if (c == '#') {
+        while (c != '\n' && c != EOF) { c = getc(input); }
+    } else {
+        ungetc(c, input);
+    }
+}
+
+// Evaluates forms back to back without any prompt output. Errors are
+// reported on stderr and evaluation carries on; the exit status tells
+// whether any form failed.
+static int run_batch(VM *vm, FILE *input) {
+    int status = 0;
+    Cell *exp;
+    skip_shebang(input);
+    while ((exp = lisp_read_form(vm, input)) != NULL) {
+        bool raised = is_error(exp);
+        Cell *result = raised ? exp : lisp_eval(vm, exp, &raised);
+        if (raised) {
+            fprint_expr(stderr, result);
+            fprintf(stderr, "\n");
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// run_batch on the file at path
+static int run_file(VM *vm, char *path) {
+    FILE *input = fopen(path, "r");
+    if (input == NULL) {
+        perror(path);
+        return 1;
+    }
+    int status = run_batch(vm, input);
+    fclose(input);
+    return status;
+}
+
+static size_t live_cells(VM *vm) {
+    Census census;
+    heap_census(vm, &census);
+    return census.liveCells;
+}
+
+static int run_repl(VM *vm) {
     while (true) {
-        debuglog("before, %d(%d)\n", getVM()->numObjs, count_obj(env));
+        debuglog("before, %d(%zu)\n", vm->numObjs, live_cells(vm));
         printf(";;; Eval input:\n");
-        Cell *exp = lisp_read(stdin);
+        Cell *exp = lisp_read_form(vm, stdin);
+        if (exp == NULL)
+            return 0;
         /* print_expr(exp); */
         /* exit(1); */
         printf("\n");
-        Cell *result = eval(exp, env);
+        bool raised;
+        Cell *result = lisp_eval(vm, exp, &raised);
 
         printf(";;; Eval value:\n");
         print_expr(result);
         printf("\n");
 
         /* int freed = destroyObject(getVM(), exp); */
-        debuglog("after, %d(%d)\n", getVM()->numObjs, count_obj(env));
+        debuglog("after, %d(%zu)\n", vm->numObjs, live_cells(vm));
+    }
+}
+
+static VM *stats_vm = NULL;
+static char *stats_path = NULL;
+static char *profile_path = NULL;
+
+// at exit, so that (exit n) is covered as well
+static void dump_stats(void) {
+    FILE *out = fopen(stats_path, "w");
+    if (out == NULL) {
+        perror(stats_path);
+        return;
     }
+    stats_dump_json(stats_vm, out);
+    fclose(out);
+}
+
+static void dump_profile(void) {
+    if (!profile_stop(stats_vm, profile_path))
+        perror(profile_path);
+}
+
+int main(int argc, char **argv) {
+    char *image = NULL;
+    bool repl = false;
+    bool trace = false;
+    bool optimize = false;
+    char *serve_path = NULL;
+    ServerLimits limits = {SERVER_TIMEOUT, SERVER_ALLOC_MAX};
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (string_eq(argv[i], "--image") && i + 1 < argc) {
+            image = argv[++i];
+        } else if (string_eq(argv[i], "--repl") || string_eq(argv[i], "-i")) {
+            repl = true;
+        } else if (string_eq(argv[i], "--trace")) {
+            trace = true;
+        } else if (string_eq(argv[i], "--optimize")) {
+            optimize = true;
+        } else if (string_eq(argv[i], "--stats") && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (string_eq(argv[i], "--profile") && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (string_eq(argv[i], "--serve") && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (string_eq(argv[i], "--timeout") && i + 1 < argc) {
+            limits.timeout = atol(argv[++i]);
+        } else if (string_eq(argv[i], "--max-alloc") && i + 1 < argc) {
+            limits.allocMax = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    char *script = i < argc ? argv[i++] : NULL;
+    // the loop reads stdin, it cannot be the script as well
+    if (repl && script != NULL && string_eq(script, "-")) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    VM *vm = image ? lisp_open_image(image) : lisp_open();
+    if (vm == NULL) {
+        fprintf(stderr, "ERROR: cannot load image %s\n", image);
+        return 1;
+    }
+    vm->trace = trace;
+    vm->optimize = optimize;
+    census_on_signal(SIGUSR1);
+    stats_vm = vm;
+    if (stats_path)
+        atexit(dump_stats);
+    if (profile_path && profile_start(vm))
+        atexit(dump_profile);
+
+    // the rest of the command line is the script's
+    Cell *args = nil();
+    for (int j = argc - 1; j >= i; j--) {
+        args = cons(make_cstring(argv[j]), args);
+    }
+    lisp_define(vm, "*args*", args);
+
+    if (serve_path != NULL) {
+        int status = script ? run_file(vm, script) : 0;
+        if (status != 0)
+            return status;
+        return lisp_serve(vm, serve_path, limits);
+    }
+
+    if (repl) {
+        int status = script ? run_file(vm, script) : 0;
+        if (status != 0)
+            return status;
+        return run_repl(vm);
+    }
+
+    if (script == NULL && isatty(STDIN_FILENO))
+        return run_repl(vm);
+
+    if (script == NULL || string_eq(script, "-"))
+        return run_batch(vm, stdin);
+
+    return run_file(vm, script);
 }
@@ -0,0 +1,6 @@
+; integer arithmetic, and car/cdr of nil
+(if (= (+ 1 2 3) 6) t (exit 2))
+(if (= (- 10 3 2) 5) t (exit 2))
+(if (= (* 2 3 4) 24) t (exit 2))
+(if (< 1 2) t (exit 2))
+(if (cdr nil) (exit 2) t)
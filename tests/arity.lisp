@@ -0,0 +1,6 @@
+; primitives check their argument count before they are called,
+; the last form must fail
+(if (eq (car (cons (quote a) nil)) (quote a)) t (exit 2))
+(if (eq (list) nil) t (exit 2))
+(if (eq (car (cdr (list 1 (quote b)))) (quote b)) t (exit 2))
+(car (quote (a)) (quote b))
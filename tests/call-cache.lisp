@@ -0,0 +1,22 @@
+; call sites cache global callees until the binding changes
+(define (g) 1)
+(define (f) (g))
+(if (= (f) 1) t (exit 2))
+(define (g) 2)
+(if (= (f) 2) t (exit 2))
+(set! g (lambda () 3))
+(if (= (f) 3) t (exit 2))
+; a parameter shadows the global for the sites inside its procedure
+(define (h g) (g))
+(if (= (h (lambda () 4)) 4) t (exit 2))
+(if (= (f) 3) t (exit 2))
+(define (k) (set! g (lambda () 5)) (g))
+(if (= (k) 5) t (exit 2))
+; expansions of a macro share a site, evaluated in different scopes
+(define-macro (call-g1) '(begin (g1 1)))
+(define (g1 x) 'global)
+(define (in-global) (call-g1))
+(define (in-local g1) (call-g1))
+(if (eq (in-global) 'global) t (exit 2))
+(if (eq (in-local (lambda (x) 'local)) 'local) t (exit 2))
+(if (eq (in-global) 'global) t (exit 2))
@@ -0,0 +1,12 @@
+; a heap census survives the cyclic env of a closure
+(define (f x) (cons x x))
+(define g (lambda (y) (f y)))
+(g 1)
+(define census (heap-census))
+(if (eq (car (car census)) (quote heap-cells)) t (exit 2))
+(if (eq (car (car (cdr (cdr (cdr census))))) (quote live-by-type)) t (exit 2))
+; what the region frames of the calls being evaluated bind is live
+(define (assq k l) (if (eq (car (car l)) k) (cdr (car l)) (assq k (cdr l))))
+(define (iota n) (if (= n 0) nil (cons n (iota (- n 1)))))
+(define (live-in-call l) (assq 'live-cells (heap-census)))
+(if (< 900 (- (live-in-call (iota 1000)) (live-in-call nil))) t (exit 2))
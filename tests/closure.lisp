@@ -0,0 +1,12 @@
+; procedures that capture their env keep heap frames, the others get
+; region frames that go away on return
+(define (make-adder n) (lambda (x) (+ x n)))
+(define add2 (make-adder 2))
+(if (= (add2 3) 5) t (exit 2))
+(define (bump x) (set! x (+ x 1)) x)
+(if (= (bump 1) 2) t (exit 2))
+(define (count-down n) (if (= n 0) (quote done) (count-down (- n 1))))
+(if (eq (count-down 3000) (quote done)) t (exit 2))
+(define (local-define x) (define y (+ x 1)) y)
+(if (= (local-define 1) 2) t (exit 2))
+(if (= (add2 40) 42) t (exit 2))
@@ -0,0 +1,57 @@
+; compile-file replaces the procedures of a file with compiled ones, needs
+; the default STATS=1 build to count calls
+(define (lookup key alist)
+  (if (eq alist nil) nil
+      (if (eq (car (car alist)) key) (cdr (car alist))
+          (lookup key (cdr alist)))))
+(define (calls name) (lookup name (lookup 'calls (runtime-stats))))
+
+(define (memq x l)
+  (if (eq l nil) nil (if (eq (car l) x) l (memq x (cdr l)))))
+
+; the rest of the file only runs when it is loaded
+(load "tests/compiled.lisp")
+(define names (compile-file "tests/compiled.lisp" "build/compiled.so"))
+(if (memq 'fib names) t (exit 2))
+(if (memq 'adder names) (exit 2) t)
+
+; int arithmetic, unboxed when the arguments are integers
+(if (= (fib 20) 6765) t (exit 2))
+(if (= (negate 5) (- 0 5)) t (exit 2))
+(if (= (big) 100000) t (exit 2))
+; eq of an unboxed int is eq of the integer it was boxed as, the value is
+; compared, see compile.h
+(if (= (same 100000) 1) t (exit 2))
+(define k (big))
+(if (= (same-as-head k (list k)) 1) t (exit 2))
+(if (= (same-as-head 7 '(a)) 0) t (exit 2))
+; the recursive calls are direct, only the outer one is counted
+(if (= (fact 10) 3628800) t (exit 2))
+(if (= (calls 'fact) 1) t (exit 2))
+
+; lists, quoted data, macros and strings
+(if (= (len '(1 2 3 4)) 4) t (exit 2))
+(if (eq (car (swap (cons 1 2))) 2) t (exit 2))
+(if (eq (other 'a) nil) t (exit 2))
+(if (eq (other 'b) 'other) t (exit 2))
+(if (= (car (cdr (iota 3 nil))) 2) t (exit 2))
+(if (eq (greeting) (greeting)) t (exit 2))
+
+; calls through a parameter, and set! of a global
+(if (= (twice negate 7) 7) t (exit 2))
+(if (= (twice (adder 2) 1) 5) t (exit 2))
+(bump)
+(if (= (bump) 2) t (exit 2))
+
+; errors are raised like the interpreter raises them
+(if (error? (catch (fib 'x) (lambda (e) e))) t (exit 2))
+(if (error? (catch (swap 1) (lambda (e) e))) t (exit 2))
+
+; a compiled loop is collected in the middle as it allocates
+(churn 2500)
+(if (< (lookup 'peak-heap-cells (runtime-stats)) 2000000) t (exit 2))
+
+; the output path is only a path, whatever it holds
+(define names (compile-file "tests/compiled.lisp" "build/compiled 'quoted'; exit 1.so"))
+(if (memq 'fib names) t (exit 2))
+(if (= (fib 20) 6765) t (exit 2))
@@ -0,0 +1,23 @@
+; procedures tests/compile.lisp compiles, they work interpreted as well
+(define-macro (unless test . body) (list 'if test nil (cons 'begin body)))
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))
+(define (len l) (if (eq l nil) 0 (+ 1 (len (cdr l)))))
+(define (swap p) (cons (cdr p) (car p)))
+(define (other x) (unless (eq x 'a) 'other))
+(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))
+(define (churn n) (if (= n 0) 0 (begin (iota 1000 nil) (churn (- n 1)))))
+(define (greeting) "hello")
+(define (twice f x) (f (f x)))
+(define (negate x) (- x))
+(define (big) 100000)
+(define (same n) (if (eq n n) 1 0))
+(define (same-as-head n l) (if (eq n (car l)) 1 0))
+(define counter 0)
+(define (bump) (set! counter (+ counter 1)) counter)
+; a closure stays interpreted
+(define (adder n) (lambda (x) (+ x n)))
+
+(if (= (fib 15) 610) t (exit 2))
+(if (= (len '(a b c)) 3) t (exit 2))
+(if (eq (other 'a) nil) t (exit 2))
@@ -0,0 +1,29 @@
+; errors unwind to the innermost catch, unwind-protect cleans up on the way
+(if (eq (catch (cons 1 2) (lambda (e) nil)) nil) (exit 2) t)
+(if (error? (catch (car 1) (lambda (e) e))) t (exit 2))
+(if (error? (catch undefined-variable (lambda (e) e))) t (exit 2))
+(if (error? (catch (exit "2") (lambda (e) e))) t (exit 2))
+(if (eq (catch (error "boom") (lambda (e) (quote caught))) (quote caught))
+    t (exit 2))
+
+; the handler runs after the stack is unwound, a raise in it goes outwards
+(if (eq (catch (catch (error "inner") (lambda (e) (error "outer")))
+               (lambda (e) (quote outer)))
+        (quote outer))
+    t (exit 2))
+
+(define cleaned nil)
+(if (eq (unwind-protect 1 (set! cleaned t)) 1) t (exit 2))
+(if cleaned t (exit 2))
+(set! cleaned nil)
+(catch (unwind-protect (error 42) (set! cleaned t)) (lambda (e) nil))
+(if cleaned t (exit 2))
+
+; frames of the calls unwound are released, calls after that still work
+(define (deep n) (if (= n 0) (car n) (+ 1 (deep (- n 1)))))
+(define (sum n) (if (= n 0) 0 (+ n (sum (- n 1)))))
+(catch (deep 500) (lambda (e) 0))
+(if (= (sum 100) 5050) t (exit 2))
+(if (= (catch (+ 1 (deep 10)) (lambda (e) (sum 10))) 55) t (exit 2))
+; a form whose value is an error has not failed
+(catch (error "caught") (lambda (e) e))
@@ -0,0 +1,40 @@
+// A native extension for tests/extension.lisp, built by make test.
+
+#include "extension.h"
+
+static Cell *remembered = NULL;
+
+static Cell *ext_reverse(int argc, Cell **argv) {
+    Cell *acc = nil();
+    dolist_cdr(c, argv[0]) {
+        acc = cons(car(c), acc);
+    }
+    return acc;
+}
+
+// keeps its argument across top level forms, hence the GC root
+static Cell *ext_remember(int argc, Cell **argv) {
+    remembered = argv[0];
+    return remembered;
+}
+
+static Cell *ext_recall(int argc, Cell **argv) {
+    return remembered;
+}
+
+static const PrimDef ext_prims[] = {
+    {"reverse", ext_reverse, 1, 1},
+    {"remember", ext_remember, 1, 1},
+    {"recall", ext_recall, 0, 0},
+};
+
+int lisp_extension_init(VM *vm, int apiVersion) {
+    if (apiVersion != EXTENSION_API_VERSION)
+        return 1;
+    remembered = nil();
+    ext_gc_root(vm, &remembered);
+    for (size_t i = 0; i < sizeof(ext_prims) / sizeof(ext_prims[0]); i++) {
+        ext_define_prim(vm, &ext_prims[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+; primitives from a native extension, see tests/ext-sample.c
+(load-extension "build/ext-sample.so")
+(if (eq (car (reverse (list (quote a) (quote b)))) (quote b)) t (exit 2))
+(remember (list (quote kept)))
+(if (eq (car (recall)) (quote kept)) t (exit 2))
+; the middle of a reversed list stays put
+(if (eq (car (cdr (reverse (list 1 (quote b) 3)))) (quote b)) t (exit 2))
+
+; what an extension roots survives collections, moved where they move it
+(define (assq k l) (if (eq (car (car l)) k) (cdr (car l)) (assq k (cdr l))))
+(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))
+(define (churn n) (if (= n 0) 0 (begin (build 1000 nil) (churn (- n 1)))))
+(churn 1200)
+(remember (list (quote moved) 1000000 "kept"))
+(define before (runtime-stats))
+(churn 1200)
+(churn 1200)
+(define after (runtime-stats))
+(if (eq after nil) t
+    (if (< (assq 'gc-cycles before) (assq 'gc-cycles after)) t (exit 2)))
+(if (eq (car (recall)) (quote moved)) t (exit 2))
+(if (= (car (cdr (recall))) 1000000) t (exit 2))
+(if (string=? (car (cdr (cdr (recall)))) "kept") t (exit 2))
@@ -0,0 +1,52 @@
+; futures run on worker threads, touch waits for their values
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(if (= (touch (future (fib 15))) 610) t (exit 2))
+(if (= (touch 7) 7) t (exit 2))
+
+; the body closes over the frame it is made in
+(define (add-later x y) (future (define z (+ x y)) (* z 2)))
+(if (= (touch (add-later 3 4)) 14) t (exit 2))
+
+; what a future raises is raised again by touch, every time
+(define failing (future (car 1)))
+(if (error? (catch (touch failing) (lambda (e) e))) t (exit 2))
+(if (error? (catch (touch failing) (lambda (e) e))) t (exit 2))
+
+; futures making and touching futures
+(define (pfib n)
+  (if (< n 12) (fib n)
+      ((lambda (a) (+ (pfib (- n 2)) (touch a))) (future (pfib (- n 1))))))
+(if (= (pfib 20) 6765) t (exit 2))
+
+(define (iota n) (if (= n 0) nil (cons n (iota (- n 1)))))
+(define (same a b)
+  (if (eq a nil) (eq b nil)
+      (if (= (car a) (car b)) (same (cdr a) (cdr b)) nil)))
+(define (map f l) (if (eq l nil) nil (cons (f (car l)) (map f (cdr l)))))
+(if (same (pmap fib (iota 20)) (map fib (iota 20))) t (exit 2))
+(if (eq (pmap fib nil) nil) t (exit 2))
+
+; the futures not touched yet survive collections between forms
+(define pending (pmap (lambda (n) (future (iota n))) (iota 50)))
+(define (churn n) (if (= n 0) 0 (begin (iota 1000) (churn (- n 1)))))
+(churn 500)
+(churn 500)
+(churn 500)
+(if (same (touch (car pending)) (iota 50)) t (exit 2))
+(if (same (touch (car (cdr pending))) (iota 49)) t (exit 2))
+
+; futures allocating twice as much as the heap are collected as they run
+(define (assq k l) (if (eq (car (car l)) k) (cdr (car l)) (assq k (cdr l))))
+(define (sum l) (if (eq l nil) 0 (+ (car l) (sum (cdr l)))))
+(define (churn-sum n) (if (= n 0) (sum (iota 100))
+                          (begin (iota 1000) (churn-sum (- n 1)))))
+(define before (runtime-stats))
+(define churners (map (lambda (n) (future (churn-sum n))) '(1100 1100)))
+(if (= (+ (churn-sum 400) (touch (car churners)) (touch (car (cdr churners))))
+       15150)
+    t (exit 2))
+(define after (runtime-stats))
+(if (eq after nil) t
+    (if (< (assq 'gc-cycles before) (assq 'gc-cycles after))
+        (if (< (assq 'peak-heap-cells after) 2500000) t (exit 2))
+        (exit 2)))
@@ -0,0 +1,20 @@
+; a form collects while it is evaluated, what it still uses stays
+(define (assq k l) (if (eq (car (car l)) k) (cdr (car l)) (assq k (cdr l))))
+(define (iota n) (if (= n 0) nil (cons n (iota (- n 1)))))
+(define (sum l) (if (eq l nil) 0 (+ (car l) (sum (cdr l)))))
+(define kept (iota 100))
+(define (adder k) (lambda (x) (+ x k)))
+
+; twice as much garbage as HEAP_SIZE cells, in one form
+(define (churn n add s)
+  (if (= n 0) (add (string-length s))
+      (begin (iota 1000) (churn (- n 1) add s))))
+(define before (runtime-stats))
+(define result (churn 2200 (adder (sum kept)) (string-append "in " "use")))
+(define after (runtime-stats))
+(if (= result 5056) t (exit 2))
+(if (= (sum kept) 5050) t (exit 2))
+(if (eq after nil) t
+    (if (< (assq 'gc-cycles before) (assq 'gc-cycles after))
+        (if (< (assq 'peak-heap-cells after) 2000000) t (exit 2))
+        (exit 2)))
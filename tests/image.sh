@@ -0,0 +1,33 @@
+#!/bin/sh
+# A saved heap image starts another interpreter with the globals, closures
+# and strings of the one that saved it, which the collector then moves.
+#     sh tests/image.sh build/lisp.out
+lisp=$1
+image=${TMPDIR:-/tmp}/lisp-test-$$.image
+trap 'status=$?; rm -f "$image"; exit $status' EXIT
+
+set -e
+$lisp - <<EOF
+(define answer 42)
+(define greeting (string-append "hello, " "image"))
+(define items (list 1 'two "three"))
+(define (adder k) (lambda (x) (+ x k)))
+(define add5 (adder 5))
+(define-macro (twice x) \`(+ ,x ,x))
+(save-image "$image")
+EOF
+$lisp --image "$image" - <<'EOF'
+(if (= answer 42) t (exit 2))
+(if (string=? greeting "hello, image") t (exit 2))
+(if (eq (car (cdr items)) 'two) t (exit 2))
+(if (string=? (car (cdr (cdr items))) "three") t (exit 2))
+(if (= (add5 1) 6) t (exit 2))
+(if (= ((adder 2) 1) 3) t (exit 2))
+(if (= (twice 4) 8) t (exit 2))
+(define (iota n) (if (= n 0) nil (cons n (iota (- n 1)))))
+(define (churn n) (if (= n 0) 0 (begin (iota 1000) (churn (- n 1)))))
+(churn 600)
+(churn 600)
+(if (= (add5 answer) 47) t (exit 2))
+(if (string=? greeting "hello, image") t (exit 2))
+EOF
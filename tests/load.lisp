@@ -0,0 +1,4 @@
+; load evaluates every form of a file in the global env
+(load "tests/define.lisp")
+(if (eq (car (a (quote x))) (quote x)) t (exit 1))
+(if (load "tests/prims.lisp") t (exit 1))
@@ -0,0 +1,62 @@
+; macros, quasiquote and rest parameters
+(define (rest a . more) more)
+(if (eq (car (rest 1 (quote x) 3)) (quote x)) t (exit 2))
+(if (eq (rest 1) nil) t (exit 2))
+(if (eq (cdr '(a . b)) 'b) t (exit 2))
+(if (= (car (cdr `(1 ,(+ 1 1) ,@(list 3 4)))) 2) t (exit 2))
+(if (= (car (cdr (cdr (cdr `(1 2 ,@(list 3 4)))))) 4) t (exit 2))
+
+; a use is expanded once, when the procedure using it is defined
+(define expansions 0)
+(define-macro (unless test . body)
+  (set! expansions (+ expansions 1))
+  `(if ,test nil (begin ,@body)))
+(define (count-down n) (unless (= n 0) (count-down (- n 1))))
+(count-down 50)
+(count-down 50)
+(if (= expansions 1) t (exit 2))
+(unless nil 1)
+(if (= expansions 2) t (exit 2))
+
+(define-macro (while test . body)
+  `((lambda () (define (loop) (if ,test (begin ,@body (loop)) nil)) (loop))))
+(define i 0)
+(define total 0)
+(while (< i 10) (set! total (+ total i)) (set! i (+ i 1)))
+(if (= total 45) t (exit 2))
+
+; an expansion that closes over the frame makes it a heap frame
+(define-macro (thunk . body) `(lambda () ,@body))
+(define (make-thunk x) (thunk x))
+(define t1 (make-thunk 7))
+(define (clobber a b c) (+ a b c))
+(clobber 1 2 3)
+(if (= (t1) 7) t (exit 2))
+
+; a macro defined after a procedure using it
+(define (late x) (later x))
+(define-macro (later x) `(lambda () ,x))
+(define t2 (late 2))
+(clobber 1 2 3)
+(if (= (t2) 2) t (exit 2))
+(if (= ((late 3)) 3) t (exit 2))
+(if (= (t2) 2) t (exit 2))
+; its frame is shared with the rest of the body
+(define (counter n) (define-incrementer bump n) (bump) n)
+(define-macro (define-incrementer name var)
+  `(define (,name) (set! ,var (+ ,var 1)) ,var))
+(if (= (counter 5) 6) t (exit 2))
+(define-macro (twice x) `(+ ,x ,x))
+(define (uses-twice-late x) (twice-late x))
+(define-macro (twice-late x) `(twice ,x))
+(if (= (uses-twice-late 4) 8) t (exit 2))
+; and so is one whose first call did not fit in the region
+(define (deep-maker n a b c d e f g h i j k l m o p)
+  (if (= n 0) (mk-late n)
+      (car (cons (deep-maker (- n 1) a b c d e f g h i j k l m o p) nil))))
+(define-macro (mk-late x) (list 'lambda nil x))
+(define deep (deep-maker 2200 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15))
+(define shallow (deep-maker 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15))
+(clobber 1 2 3)
+(if (= (shallow) 0) t (exit 2))
+(if (= (deep) 0) t (exit 2))
@@ -0,0 +1,60 @@
+; the optimizer keeps the meaning of what it rewrites, needs the default
+; STATS=1 build to count calls
+(optimize t)
+(define (lookup key alist)
+  (if (eq alist nil) nil
+      (if (eq (car (car alist)) key) (cdr (car alist))
+          (lookup key (cdr alist)))))
+(define (calls name) (lookup name (lookup 'calls (runtime-stats))))
+
+; folding and constant tests
+(define (three) (+ 1 2))
+(if (= (three) 3) t (exit 2))
+(define (pick) (if 'yes 1 2))
+(if (= (pick) 1) t (exit 2))
+(define (none) (if nil 1))
+(if (eq (none) nil) t (exit 2))
+(define (first) (car '(a b)))
+(if (eq (first) 'a) t (exit 2))
+(define (bad) (car 1))
+(if (error? (catch (bad) (lambda (e) e))) t (exit 2))
+
+; dead begin subforms go, effects stay
+(define count 0)
+(define (tick) (set! count (+ count 1)) count)
+(define (seq) (begin 1 'two (tick) 3))
+(if (= (seq) 3) t (exit 2))
+(if (= count 1) t (exit 2))
+
+; immediately applied lambdas and small procedures are substituted
+(define (beta x) ((lambda (y) (+ y 1)) x))
+(if (= (beta 1) 2) t (exit 2))
+(define (square x) (* x x))
+(define (sum-squares a b) (+ (square a) (square b)))
+(if (= (sum-squares 3 4) 25) t (exit 2))
+(if (eq (calls 'square) nil) t (exit 2))
+
+; redefining or assigning an inlined procedure is seen by its callers
+(define (square x) (+ x x))
+(if (= (sum-squares 3 4) 14) t (exit 2))
+(set! square (lambda (x) 0))
+(if (= (sum-squares 3 4) 0) t (exit 2))
+
+; a global of the inlined body named like a local of the caller
+(define n 100)
+(define (add-n x) (+ x n))
+(define (shadow n) (add-n n))
+(if (= (shadow 1) 101) t (exit 2))
+
+; an assigned variable is not substituted
+(define (double x) (+ x x))
+(define (assigned x) (set! x 5) (double x))
+(if (= (assigned 1) 10) t (exit 2))
+(define (effect) (double (tick)))
+(set! count 0)
+(if (= (effect) 2) t (exit 2))
+(if (= count 1) t (exit 2))
+
+; recursion is left alone
+(define (fact n) (if (< n 2) 1 (* n (fact (- n 1)))))
+(if (= (fact 5) 120) t (exit 2))
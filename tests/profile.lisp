@@ -0,0 +1,17 @@
+; the profiler writes folded stacks when stopped and can be started again
+(define (walk l) (if l (walk (cdr l)) nil))
+(define (iota n) (if (= n 0) nil (cons n (iota (- n 1)))))
+(define long (iota 1000))
+(define (spin n) (if (= n 0) nil (begin (walk long) (spin (- n 1)))))
+(profile-start)
+(spin 300)
+(if (eq (profile-stop "build/profile.folded") t) t (exit 2))
+; samples were taken, with the workload's frames in them
+(define (sampled? s)
+  (stream-fold (lambda (found line)
+                 (if found found (string-search "spin;walk" line)))
+               nil s))
+(if (sampled? (port-stream (open-input-file "build/profile.folded") 'lines))
+    t (exit 2))
+(profile-start)
+(profile-stop "build/profile.folded")
@@ -0,0 +1,36 @@
+#!/bin/sh
+# The evaluation server answers pipelined requests from several connections,
+# interrupts a request past its limits and carries on with the next.
+#     sh tests/server.sh build/lisp.out build/load-test.out
+lisp=$1
+load=$2
+sock=${TMPDIR:-/tmp}/lisp-test-$$.sock
+
+$lisp --serve "$sock" --timeout 1000 --max-alloc 50000 &
+server=$!
+trap 'status=$?; kill $server 2> /dev/null || true; exit $status' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$sock" ] && break
+    sleep 0.2
+done
+
+set -e
+$load --socket "$sock" --connections 4 --requests 500 --pipeline 8 \
+      --expect 3 "(+ 1 2)"
+# definitions stay for the requests after
+$load --socket "$sock" --requests 1 --expect 120 \
+      "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1))))) (fact 5)"
+$load --socket "$sock" --requests 10 --pipeline 10 --expect 720 "(fact 6)"
+$load --socket "$sock" --requests 1 --expect-error "(car 1)"
+# exponential work and allocation, the recursion stays shallow
+$load --socket "$sock" --requests 1 --expect-error \
+      "(define (spin n) (if (= n 0) 0 (+ (spin (- n 1)) (spin (- n 1)))))
+       (catch (spin 40) (lambda (e) (spin 40)))"
+$load --socket "$sock" --requests 1 --expect-error \
+      "(define (tree n) (if (= n 0) nil (cons (tree (- n 1)) (tree (- n 1)))))
+       (tree 40)"
+$load --socket "$sock" --requests 100 --expect 3 "(+ 1 2)"
+
+kill $server
+wait $server
+[ ! -e "$sock" ]
@@ -0,0 +1,6 @@
+; runtime statistics, needs the default STATS=1 build
+(define (f x) (list x x))
+(f 1)
+(define stats (runtime-stats))
+(if (eq (car (car stats)) (quote allocations)) t (exit 2))
+(if (eq (car (car (cdr stats))) (quote gc-cycles)) t (exit 2))
@@ -0,0 +1,76 @@
+; promises are evaluated once, when first forced
+(define forced 0)
+(define p (delay (set! forced (+ forced 1)) forced))
+(if (= forced 0) t (exit 2))
+(if (= (force p) 1) t (exit 2))
+(if (= (force p) 1) t (exit 2))
+(if (= forced 1) t (exit 2))
+(if (= (force 5) 5) t (exit 2))
+; a raise leaves it to be forced again
+(define tries 0)
+(define flaky (delay (set! tries (+ tries 1)) (if (= tries 1) (car 1) tries)))
+(if (error? (catch (force flaky) (lambda (e) e))) t (exit 2))
+(if (= (force flaky) 2) t (exit 2))
+
+(define (integers-from n) (cons-stream n (integers-from (+ n 1))))
+(define nat (integers-from 0))
+(if (= (stream-car (stream-cdr (stream-cdr nat))) 2) t (exit 2))
+(define (to-list s) (reverse (stream-fold (lambda (l x) (cons x l)) nil s)))
+(define (reverse l) (stream-fold (lambda (r x) (cons x r)) nil l))
+(define (same a b)
+  (if (eq a nil) (eq b nil)
+      (if (= (car a) (car b)) (same (cdr a) (cdr b)) nil)))
+(if (same (to-list (stream-take 4 nat)) '(0 1 2 3)) t (exit 2))
+(if (same (to-list (stream-take 3 (stream-map (lambda (x) (* x x)) nat)))
+          '(0 1 4))
+    t (exit 2))
+(define (small x) (< x 7))
+(if (same (to-list (stream-filter small (stream-take 10 nat))) '(0 1 2 3 4 5 6))
+    t (exit 2))
+(if (eq (stream-take 0 nat) nil) t (exit 2))
+(if (eq (stream-filter small (stream-take 5 (integers-from 7))) nil) t (exit 2))
+(if (= (stream-fold + 0 '(1 2 3)) 6) t (exit 2))
+; the rest is only made when it is needed
+(define made 0)
+(define (counted n) (cons-stream n (begin (set! made (+ made 1)) (counted (+ n 1)))))
+(stream-fold + 0 (stream-take 5 (counted 0)))
+(if (= made 4) t (exit 2))
+
+; forms and lines read from a file as they are needed
+(define first-line
+  (stream-car (port-stream (open-input-file "tests/stream.lisp") 'lines)))
+(if (string=? first-line "; promises are evaluated once, when first forced") t (exit 2))
+(define forms (port-stream (open-input-file "tests/stream.lisp")))
+(if (eq (car (stream-car forms)) 'define) t (exit 2))
+(define lines (port-stream (open-input-file "tests/stream.lisp") 'lines))
+(define (count-lines s) (stream-fold (lambda (n line) (+ n 1)) 0 s))
+(define n (count-lines lines))
+(if (< 40 n) t (exit 2))
+; a stream kept is read once
+(if (= (count-lines lines) n) t (exit 2))
+(if (error? (catch (open-input-file "tests/no-such-file") (lambda (e) e))) t (exit 2))
+
+; a fold collects what it no longer uses as it goes, folds in folds too
+(define (assq k l) (if (eq (car (car l)) k) (cdr (car l)) (assq k (cdr l))))
+(define (inner n) (stream-fold (lambda (acc s) (+ acc (string-length s))) 0
+                               (stream-take n (stream-map (lambda (i) "abc") nat))))
+(if (= (stream-fold (lambda (acc x) (+ acc (inner 30))) 0 (stream-take 30 nat))
+       2700)
+    t (exit 2))
+(define before (runtime-stats))
+(define sum
+  (stream-fold + 0 (stream-take 60000
+                                (stream-filter (lambda (x) (< 0 x))
+                                               (stream-map (lambda (x) (- x 50000))
+                                                           (integers-from 0))))))
+(if (= sum 1800030000) t (exit 2))
+(define after (runtime-stats))
+(if (eq after nil) t
+    (if (< (assq 'gc-cycles before) (- (assq 'gc-cycles after) 1))
+        (if (< (assq 'peak-heap-cells after) 2097152) t (exit 2))
+        (exit 2)))
+(if (eq (catch (stream-fold (lambda (n x) (if (= x 3) (car 1) x)) 0 nat)
+               (lambda (e) 'caught))
+        'caught)
+    t (exit 2))
+(if (= (stream-fold + 0 (stream-take 4 nat)) 6) t (exit 2))
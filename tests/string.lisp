@@ -0,0 +1,58 @@
+; lengths and indexes count characters, not bytes
+(if (= (string-length "") 0) t (exit 2))
+(if (= (string-length "hello") 5) t (exit 2))
+(if (= (string-length "héllo wörld") 11) t (exit 2))
+(if (string=? (substring "héllo wörld" 1 4) "éll") t (exit 2))
+(if (string=? (substring "héllo wörld" 6) "wörld") t (exit 2))
+(if (error? (catch (substring "abc" 2 5) (lambda (e) e))) t (exit 2))
+(if (error? (catch (string-length 'abc) (lambda (e) e))) t (exit 2))
+
+(if (string=? (string-append "a" "" "bc" "dé") "abcdé") t (exit 2))
+(if (string=? (string-append) "") t (exit 2))
+(if (string=? "abc" "abd") (exit 2) t)
+(if (string=? "abc" "abcd") (exit 2) t)
+(if (string=? "tab\t\"q\"\\" (string-append "tab\t" "\"q\"" "\\")) t (exit 2))
+
+(if (= (string-search "wö" "héllo wörld") 6) t (exit 2))
+(if (= (string-search "l" "héllo wörld" 4) 9) t (exit 2))
+(if (eq (string-search "x" "héllo wörld") nil) t (exit 2))
+(if (= (string-search "" "abc") 0) t (exit 2))
+
+(define (same-strings a b)
+  (if (eq a nil) (eq b nil)
+      (if (string=? (car a) (car b)) (same-strings (cdr a) (cdr b)) nil)))
+(if (same-strings (string-split "a,b,,c" ",") '("a" "b" "" "c")) t (exit 2))
+(if (same-strings (string-split "a->b->" "->") '("a" "b" "")) t (exit 2))
+(if (same-strings (string-split "abc" ",") '("abc")) t (exit 2))
+
+; a builder prints what is not a string
+(define b (make-string-builder))
+(string-builder-add! b "x = ")
+(string-builder-add! b 42)
+(string-builder-add! b '(1 ö))
+(define built (string-builder-result b))
+(if (string=? built "x = 42(1 ö)") t (exit 2))
+(if (= (string-length built) 11) t (exit 2))
+; the strings made before keep their value as it grows
+(define (add-times b x n)
+  (if (= n 0) b (begin (string-builder-add! b x) (add-times b x (- n 1)))))
+(add-times b "ünïcode and ascii " 200)
+(if (string=? built "x = 42(1 ö)") t (exit 2))
+
+; long enough for the vector kernels, with the match past the first blocks
+(define long (string-builder-result b))
+(if (= (string-length long) 3611) t (exit 2))
+(define tail (string-append long "needle" long))
+(if (= (string-search "needle" tail) 3611) t (exit 2))
+(if (string=? (substring tail 3611 3617) "needle") t (exit 2))
+(if (= (string-length (car (string-split tail "needle"))) 3611) t (exit 2))
+(if (string=? (string-append long "a") (string-append long "b")) (exit 2) t)
+(if (string=? (string-append long "a") (string-append long "a")) t (exit 2))
+
+; slices outlive the strings they come from through collections
+(define parts (string-split (string-append long "|" long "|end") "|"))
+(define (churn n) (if (= n 0) 0 (begin (string-split long " ") (churn (- n 1)))))
+(churn 50)
+(churn 50)
+(if (string=? (car (cdr (cdr parts))) "end") t (exit 2))
+(if (string=? (car parts) long) t (exit 2))
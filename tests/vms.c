@@ -0,0 +1,74 @@
+// Independent interpreters on threads of their own, built and run by make
+// test. Each one defines the same globals, collects between and in the
+// middle of its forms, and has to come up with its own values.
+//     build/vms-test.out [threads]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "lisp.h"
+
+#define THREADS_MAX 64
+#define ROUNDS 2
+
+static const char *program =
+    "(define (iota n) (if (= n 0) nil (cons n (iota (- n 1)))))"
+    "(define (sum l) (if (eq l nil) 0 (+ (car l) (sum (cdr l)))))"
+    "(define (churn n) (if (= n 0) 0 (begin (iota 1000) (churn (- n 1)))))"
+    "(define kept (iota 100))";
+
+typedef struct {
+    int id;
+    bool ok;
+} Run;
+
+// the value of src, an int, or -1
+static long eval_int(VM *vm, char *src) {
+    bool raised;
+    Cell *x = lisp_eval_string(vm, src, &raised);
+    return !raised && is_integer(x) ? int_val(x) : -1;
+}
+
+static void *run(void *arg) {
+    Run *r = arg;
+    VM *vm = lisp_open();
+    bool raised;
+    lisp_eval_string(vm, (char*)program, &raised);
+    r->ok = !raised;
+    char src[128];
+    snprintf(src, sizeof src, "(define id %d)", r->id);
+    lisp_eval_string(vm, src, &raised);
+    for (int i = 0; r->ok && i < ROUNDS; i++) {
+        // a form allocating more than the heap, then one between forms
+        r->ok = eval_int(vm, "(begin (churn 1100) (+ (sum kept) id))")
+            == 5050 + r->id;
+        r->ok = r->ok && eval_int(vm, "(churn 100)") == 0;
+    }
+    r->ok = r->ok && eval_int(vm, "id") == r->id;
+    lisp_close(vm);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    if (threads < 1 || threads > THREADS_MAX) {
+        fprintf(stderr, "usage: %s [threads], 1 to %d\n", argv[0],
+                THREADS_MAX);
+        return 1;
+    }
+    pthread_t tids[THREADS_MAX];
+    Run runs[THREADS_MAX];
+    for (int i = 0; i < threads; i++) {
+        runs[i] = (Run){.id = i};
+        pthread_create(&tids[i], NULL, run, &runs[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        if (!runs[i].ok) {
+            fprintf(stderr, "interpreter %d: unexpected result\n", i);
+            failed = 1;
+        }
+    }
+    return failed;
+}